@@ -14,6 +14,10 @@
 
 #define ADC_TRESHOLD 10
 
+// One free-running conversion is 13 ADC clocks, adcStart() selects
+// a prescale of 64 (125 kHz @ 8 MHz, i.e. 104 us per conversion)
+#define ADC_CONVERSION_US (13L * 64 * 1000000L / F_CPU)
+
 static inline uint16_t adcRead() {
 	return ADC;
 }
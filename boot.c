@@ -0,0 +1,314 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Firmware update bootloader, see boot.h for the protocol.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+
+#include "ps2.h"
+#include "boot.h"
+
+#ifdef PS2_UPDATE
+
+// Fastest clock allowed by PS/2 (16.7 kHz) to keep update time down
+#define BOOT_HALF_CLOCK_US 30
+
+#ifndef SPMEN
+#define SPMEN SELFPRGEN // ATtiny45/85 name
+#endif
+
+// Clear the SPM page buffer, avr/boot.h has no macro for it
+#ifndef boot_page_buffer_clear
+#define boot_page_buffer_clear() { \
+	SPMCSR = _BV(CTPB) | _BV(SPMEN); \
+	asm volatile("spm"); \
+}
+#endif
+
+// Receive states, BOOT_STATE_DONE acts after the reply has been sent
+#define BOOT_STATE_COMMAND 0
+#define BOOT_STATE_PAGE 1
+#define BOOT_STATE_DATA 2
+#define BOOT_STATE_CRC_LOW 3
+#define BOOT_STATE_CRC_HIGH 4
+#define BOOT_STATE_DONE 5
+
+// The inline functions in ps2.h are not guaranteed to be inlined, and
+// a call out of the bootloader section could land in erased flash
+#define BOOT_HOLD_CLOCK() { \
+	PS2_CLOCK_PORT &= ~_BV(PS2_CLOCK_PIN); \
+	PS2_CLOCK_DDR |= _BV(PS2_CLOCK_PIN); \
+}
+#define BOOT_RELEASE_CLOCK() { \
+	PS2_CLOCK_DDR &= ~_BV(PS2_CLOCK_PIN); \
+	PS2_CLOCK_PORT |= _BV(PS2_CLOCK_PIN); \
+}
+#define BOOT_HOLD_DATA() { \
+	PS2_DATA_PORT &= ~_BV(PS2_DATA_PIN); \
+	PS2_DATA_DDR |= _BV(PS2_DATA_PIN); \
+}
+#define BOOT_RELEASE_DATA() { \
+	PS2_DATA_DDR &= ~_BV(PS2_DATA_PIN); \
+	PS2_DATA_PORT |= _BV(PS2_DATA_PIN); \
+}
+
+// One clock pulse starting and ending in the middle of clock high,
+// which is where data is changed (sending) or sampled (receiving)
+#define BOOT_CLOCK_PULSE() { \
+	_delay_us(BOOT_HALF_CLOCK_US / 2); \
+	BOOT_HOLD_CLOCK(); \
+	_delay_us(BOOT_HALF_CLOCK_US); \
+	BOOT_RELEASE_CLOCK(); \
+	_delay_us(BOOT_HALF_CLOCK_US / 2); \
+}
+
+// CRC-16/XMODEM of one more byte, i is a scratch variable
+#define BOOT_CRC(crc, byte, i) { \
+	(crc) ^= (byte) << 8; \
+	for(i = 0; i < 8; i++) \
+		(crc) = ((crc) & 0x8000) ? ((crc) << 1) ^ 0x1021 : (crc) << 1; \
+}
+
+#define BOOT_EEPROM_READ(addr, value) { \
+	EEAR = (addr); \
+	EECR |= _BV(EERE); \
+	(value) = EEDR; \
+}
+
+// Also waits for completion, SPM must not run during EEPROM write
+#define BOOT_EEPROM_WRITE(addr, value) { \
+	EECR = 0; /* erase and write */ \
+	EEAR = (addr); \
+	EEDR = (value); \
+	EECR |= _BV(EEMPE); \
+	EECR |= _BV(EEPE); \
+	while(EECR & _BV(EEPE)) ; \
+}
+
+void bootMain() {
+	uint8_t state = BOOT_STATE_COMMAND, reply = BOOT_READY;
+	uint8_t command = 0, written = 0; // page 0 written in this session
+	uint8_t erase = 0; // page has bits the new data needs set again
+	uint8_t page = 0, n = 0, low = 0, byte, parity, i;
+	uint16_t crc = 0, vector = 0, frame, addr, rjmp;
+
+	// Entered from reset vector there is no C runtime setup
+#ifdef __AVR__ // not in the host simulator
+	asm volatile("clr __zero_reg__");
+#endif
+	MCUSR = 0; // WDRF would keep watchdog at its shortest timeout
+	wdt_enable(WDTO_1S);
+
+	if(GPIOR0 != BOOT_MAGIC) { // reset, start application if valid
+		BOOT_EEPROM_READ(BOOT_EEPROM_VALID, byte);
+
+		if(byte == BOOT_VALID) {
+			BOOT_EEPROM_READ(BOOT_EEPROM_VECTOR, byte);
+			vector = byte;
+			BOOT_EEPROM_READ(BOOT_EEPROM_VECTOR + 1, byte);
+			vector |= byte << 8;
+
+			((void (*)())(uintptr_t)vector)();
+		}
+	} else { // requested by application, invalidate it
+		GPIOR0 = 0;
+
+		BOOT_EEPROM_WRITE(BOOT_EEPROM_VALID, 0xFF);
+
+		// Nothing of the old application survives, and pages the host
+		// skips read back blank for the image CRC. Top down and page 0
+		// last: a reset in between runs the old entry into erased flash,
+		// which slides through 0xFFFF into the bootloader.
+		for(page = BOOT_PAGES - 1; page; page--) {
+			boot_page_erase(page * SPM_PAGESIZE);
+			boot_spm_busy_wait();
+			wdt_reset();
+		}
+
+		boot_page_erase(0);
+		boot_spm_busy_wait();
+		boot_page_fill(0, BOOT_RESET_VECTOR);
+		boot_page_write(0);
+		boot_spm_busy_wait();
+	}
+
+	BOOT_RELEASE_CLOCK();
+	BOOT_RELEASE_DATA();
+
+	while(1) {
+		if(reply) {
+			// Wait until host is not inhibiting or sending
+			while(!isClockHigh() || !isDataHigh())
+				wdt_reset();
+
+			// Start bit, 8 data bits, odd parity and stop bit
+			frame = reply << 1;
+			parity = 1;
+
+			for(i = 0; i < 8; i++)
+				parity += (reply >> i) & 1;
+
+			frame |= (parity & 1) << 9;
+			frame |= 1 << 10;
+
+			for(i = 0; i < 11; i++) {
+				if(frame & 1)
+					BOOT_RELEASE_DATA()
+				else
+					BOOT_HOLD_DATA()
+
+				BOOT_CLOCK_PULSE();
+				frame >>= 1;
+			}
+
+			reply = 0;
+		}
+
+		if(state == BOOT_STATE_DONE) {
+			wdt_enable(WDTO_15MS); // reset to start the application
+			while(1) ;
+		}
+
+		// Wait for host request to send: clock released, data low
+		while(!isClockHigh() || isDataHigh())
+			wdt_reset();
+
+		// 8 data bits, parity and stop bit
+		frame = 0;
+		parity = 0;
+
+		for(i = 0; i < 10; i++) {
+			BOOT_CLOCK_PULSE();
+			frame >>= 1;
+
+			if(isDataHigh()) {
+				frame |= 1 << 9;
+				parity++;
+			}
+		}
+
+		// Acknowledge, host releases data after the stop bit
+		BOOT_HOLD_DATA();
+		BOOT_CLOCK_PULSE();
+		BOOT_RELEASE_DATA();
+
+		byte = frame;
+
+		if(parity & 1) { // with stop bit (1) included, should be even
+			reply = BOOT_RESEND; // just this byte
+			continue;
+		}
+
+		if(state == BOOT_STATE_PAGE || state == BOOT_STATE_DATA)
+			BOOT_CRC(crc, byte, i);
+
+		if(state == BOOT_STATE_COMMAND) {
+			if(byte == BOOT_CMD_Write_Page || byte == BOOT_CMD_Done) {
+				command = byte;
+				crc = 0;
+				state = BOOT_STATE_PAGE;
+			} else // anything else the host might send
+				reply = BOOT_ACK;
+		} else if(state == BOOT_STATE_PAGE) {
+			page = byte; // page count for BOOT_CMD_Done
+
+			if(command == BOOT_CMD_Done) {
+				state = BOOT_STATE_CRC_LOW;
+				continue;
+			}
+
+			n = 0;
+			erase = 0;
+			state = BOOT_STATE_DATA;
+		} else if(state == BOOT_STATE_DATA) {
+			if(n & 1) {
+				frame = low | (byte << 8);
+
+				if(page == 0 && n == 1) { // application reset vector
+					vector = (frame + 1) & 0x0FFF; // rjmp target
+					frame = BOOT_RESET_VECTOR;
+				}
+
+				addr = page * SPM_PAGESIZE + n - 1;
+
+				// Writing only clears bits, pages erased on entry or
+				// sent again with the same data need no erase
+				if(page < BOOT_PAGES &&
+						(pgm_read_word_near(addr) & frame) != frame)
+					erase = 1;
+
+				boot_page_fill(addr, frame);
+			} else
+				low = byte;
+
+			if(++n == SPM_PAGESIZE)
+				state = BOOT_STATE_CRC_LOW;
+		} else if(state == BOOT_STATE_CRC_LOW) {
+			low = byte;
+			state = BOOT_STATE_CRC_HIGH;
+		} else if(command == BOOT_CMD_Done) { // BOOT_STATE_CRC_HIGH
+			// Read the image back, with the application's own reset
+			// vector in place of the one pointing here
+			frame = low | (byte << 8);
+			rjmp = 0xC000 | ((vector - 1) & 0x0FFF);
+			crc = 0;
+
+			for(addr = 0; addr < page * SPM_PAGESIZE; addr++) {
+				if(addr < 2)
+					byte = addr ? rjmp >> 8 : rjmp;
+				else
+					byte = pgm_read_byte_near(addr);
+
+				BOOT_CRC(crc, byte, i);
+			}
+
+			// Page 0 must be from this session, or our reset vector
+			// and the saved application vector do not match the image
+			if(written && page && page <= BOOT_PAGES && crc == frame) {
+				BOOT_EEPROM_WRITE(BOOT_EEPROM_VALID, BOOT_VALID);
+				reply = BOOT_ACK;
+				state = BOOT_STATE_DONE;
+			} else {
+				reply = BOOT_ERROR; // stay here, host can fix and retry
+				state = BOOT_STATE_COMMAND;
+			}
+		} else { // BOOT_STATE_CRC_HIGH of BOOT_CMD_Write_Page
+			if(crc == (low | (byte << 8)) && page < BOOT_PAGES) {
+				// Page buffer survives the erase, only a write or
+				// CTPB clears it
+				if(erase) {
+					boot_page_erase(page * SPM_PAGESIZE);
+					boot_spm_busy_wait();
+				}
+
+				boot_page_write(page * SPM_PAGESIZE);
+				boot_spm_busy_wait();
+
+				if(page == 0) { // remember where the application starts
+					BOOT_EEPROM_WRITE(BOOT_EEPROM_VECTOR, vector);
+					BOOT_EEPROM_WRITE(BOOT_EEPROM_VECTOR + 1, vector >> 8);
+					written = 1;
+				}
+
+				reply = BOOT_ACK;
+			} else {
+				// Clear page buffer so a retry starts from scratch
+				boot_page_buffer_clear();
+
+				reply = BOOT_ERROR;
+			}
+
+			state = BOOT_STATE_COMMAND;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Firmware update over the PS/2 link. With PS2_UPDATE defined, a small
+ * bootloader is linked to BOOT_START (see Makefile). It is entered with
+ * vendor command PS2_CMD_Vendor_Update, and from then on talks PS/2 by
+ * polling with interrupts disabled, so it does not depend on any code
+ * in the application area it rewrites.
+ *
+ * Update protocol, host to device unless noted:
+ *
+ *   0xE2                  application ACKs (0xFA) and enters bootloader
+ *   device: 0xAA          bootloader ready, application invalidated
+ *   0xE3 page data crc    write SPM_PAGESIZE data bytes to flash page,
+ *                         crc is CRC-16/XMODEM of page and data bytes,
+ *                         low byte first
+ *   device: 0xFA          page written, host can send the next one
+ *   device: 0xFC          bad CRC or page in bootloader, send it again
+ *   0xE4 pages crc        update complete, crc is CRC-16/XMODEM of
+ *                         image pages 0 to pages-1 as the host has
+ *                         them, low byte first
+ *   device: 0xFA          flash read back matches, device resets to
+ *                         the new application
+ *   device: 0xFC          mismatch, or page 0 not written since entry,
+ *                         device stays in the bootloader
+ *
+ * A single byte with bad parity is answered with 0xFE as usual, and
+ * the host repeats just that byte. All application pages are erased on
+ * entry, so pages that are all 0xFF in the new image do not need to be
+ * sent. The read back for 0xE4 takes up to about 30 ms.
+ *
+ * Data goes to the page buffer byte by byte as received, and is compared
+ * with flash on the way. Only once the CRC checks out is the page
+ * written, so a bad page leaves flash alone and a page can be sent
+ * again. The page is erased first only if it has bits the data needs
+ * set again, which after the erase on entry means a page sent twice
+ * with new data. The CPU is halted for 4.5 ms per erase or write there,
+ * before the reply, so no host byte is ever clocked late.
+ *
+ * Once the bootloader has been entered, the reset vector points to it
+ * and the application is marked invalid in EEPROM until a 0xE4 that
+ * checks out. A watchdog reset or power loss during the update thus
+ * comes back to the bootloader (which sends 0xAA again), never to a
+ * partial image. Entry erases the application from the top down and
+ * rewrites page 0 last, so a reset during entry runs into erased flash
+ * and slides into the bootloader as well.
+ *
+ * "make update" builds sim/update.c, which runs this protocol against
+ * the firmware in the host simulator, see sim.h.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __BOOT_H
+#define __BOOT_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "ps2.h"
+
+#ifdef PS2_UPDATE
+
+#ifndef BOOT_START
+#error "PS2_UPDATE needs BOOT_START, see Makefile"
+#endif
+
+#if BOOT_START % SPM_PAGESIZE
+#error "BOOT_START must be at a flash page boundary"
+#endif
+
+#define BOOT_CMD_Write_Page 0xE3
+#define BOOT_CMD_Done 0xE4
+
+#define BOOT_READY 0xAA
+#define BOOT_ACK 0xFA
+#define BOOT_ERROR 0xFC
+#define BOOT_RESEND 0xFE
+
+// Last bytes of EEPROM hold application state
+#define BOOT_EEPROM_VALID E2END
+#define BOOT_EEPROM_VECTOR (E2END - 2) // word address of application
+#define BOOT_VALID 0x5A
+
+// rjmp from reset vector (word 0) to BOOT_START, wraps around on 4K
+// word devices so it reaches the whole flash
+#define BOOT_RESET_VECTOR (0xC000 | ((BOOT_START / 2 - 1) & 0x0FFF))
+
+#define BOOT_PAGES (BOOT_START / SPM_PAGESIZE)
+
+// Everything the bootloader runs must be in this section, it can't
+// call the C library or anything else in the application area
+#define BOOTLOADER __attribute__((section(".bootloader"), noreturn))
+
+// Bootloader entry point, linked to BOOT_START
+void bootMain() BOOTLOADER;
+
+// Tells bootMain() it was entered on purpose, not through reset
+#define BOOT_MAGIC 0xB0
+
+// Leave application and start waiting for firmware update
+static inline void __attribute__((noreturn)) bootEnter() {
+	cli();
+	releaseClock();
+	releaseData();
+	GPIOR0 = BOOT_MAGIC;
+	bootMain();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Optional sensor-to-keystroke latency histograms, see latency.h.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include "ps2.h"
+#include "latency.h"
+
+#ifdef LATENCY
+
+uint8_t latencyHistogram[LATENCY_HISTOGRAMS][LATENCY_BUCKETS];
+Timestamp latencyStamps[LATENCY_STAGES];
+volatile uint8_t latencyNext = LATENCY_THRESHOLD;
+
+static void addToHistogram(uint8_t histogram, uint32_t us) {
+	uint8_t bucket = 0;
+
+	while(us >>= 1) // floor(log2(us))
+		if(++bucket == LATENCY_BUCKETS - 1)
+			break;
+
+	if(latencyHistogram[histogram][bucket] != 255)
+		latencyHistogram[histogram][bucket]++;
+}
+
+// Add a complete measurement to the histograms, call from main loop.
+// Stamps are not touched until latencyNext is reset, so no locking.
+void latencyUpdate() {
+	uint32_t first, last, us;
+	uint8_t i;
+
+	if(latencyNext != LATENCY_STAGES)
+		return;
+
+	first = last = timestampMicros(latencyStamps);
+
+	for(i = 1; i < LATENCY_STAGES; i++) {
+		us = timestampMicros(latencyStamps + i);
+		addToHistogram(i - 1, us - last);
+		last = us;
+	}
+
+	addToHistogram(LATENCY_STAGES - 1, last - first);
+
+	latencyNext = LATENCY_THRESHOLD;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Optional sensor-to-keystroke latency histograms. With LATENCY defined,
+ * each stage from a knock to the host receiving the break code is
+ * timestamped with a raw timestampNow() snapshot, which is all the PS/2
+ * interrupt has to do for its stages. LATENCY_UPDATE() in the main loop
+ * then adds the time between consecutive stages (plus the total) to a
+ * log2-bucketed histogram. Bucket n counts intervals of 2^n..2^(n+1)-1
+ * us, the last bucket also everything longer. Counts saturate at 255.
+ * Needs 110 bytes of RAM.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "ps2.h"
+
+#ifdef LATENCY
+
+#ifdef __AVR_ATtiny2313__
+#error "LATENCY histograms do not fit in ATtiny2313 RAM"
+#endif
+
+// Stages in the order they happen, must be marked in this order
+#define LATENCY_THRESHOLD 0 // sensor over threshold noticed
+#define LATENCY_TRIGGER 1 // decided to send a key press
+#define LATENCY_ENQUEUE 2 // break code about to be queued
+#define LATENCY_START_BIT 3 // start bit of last byte
+#define LATENCY_STOP_BIT 4 // stop bit of last byte
+#define LATENCY_STAGES 5 // as next stage: complete, not yet in histograms
+
+// Histograms between consecutive stages, and the total as last one
+#define LATENCY_HISTOGRAMS LATENCY_STAGES
+#define LATENCY_BUCKETS 16
+
+extern uint8_t latencyHistogram[LATENCY_HISTOGRAMS][LATENCY_BUCKETS];
+extern Timestamp latencyStamps[LATENCY_STAGES];
+
+// Next stage expected
+extern volatile uint8_t latencyNext;
+
+// Timestamp a stage. Out of order marks are ignored, except threshold
+// which starts a new measurement unless a complete one is waiting for
+// latencyUpdate(). Stop bit completes it.
+static inline void latencyMark(uint8_t stage) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if(latencyNext != LATENCY_STAGES &&
+				(stage == latencyNext || stage == LATENCY_THRESHOLD)) {
+			timestampNow(latencyStamps + stage);
+			latencyNext = stage + 1;
+		}
+	}
+}
+
+// Add a complete measurement to the histograms, call from main loop
+void latencyUpdate();
+
+// Skips the atomic block when nothing is being measured (e.g. in interrupts)
+#define LATENCY_MARK(stage) { \
+	if((stage) == LATENCY_THRESHOLD || latencyNext == (stage)) \
+		latencyMark(stage); \
+}
+
+#define LATENCY_UPDATE() latencyUpdate()
+
+#else
+
+#define LATENCY_MARK(stage)
+#define LATENCY_UPDATE()
+
+#endif
+
+#endif
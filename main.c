@@ -13,15 +13,26 @@
 #include "ps2config.h"
 #include "ring.h"
 #include "ps2.h"
+#include "power.h"
+#include "profile.h"
+#include "latency.h"
+#include "boot.h"
 
 #ifndef USE_BUTTON
 #include "adc.h"
 #endif
 
+void waitMillis(uint16_t ms) {
+    uint32_t start = millisNow();
+
+    while(millisNow() - start < ms)
+        powerIdle();
+}
+
 void sendCode(uint8_t code) {
     MAKE_CODE(code);
-    for(millis = 0; millis < 10; ) 
-        wdt_reset();
+    waitMillis(10);
+    LATENCY_MARK(LATENCY_ENQUEUE);
     BREAK_CODE(code);
 }
 
@@ -40,17 +51,119 @@ void sendNibble(uint8_t n) {
 
 void sendHex(uint8_t hex) {
     sendNibble(hex >> 4);
+    waitMillis(10);
+    sendNibble(hex & 15);
+}
+#endif
 
-    for(millis = 0; millis < 10; ) 
-        wdt_reset();
+#if defined(LATENCY) || defined(PS2_UPDATE)
+// Wait until the byte queued last has been picked up for sending, or
+// with idle set, until it is fully sent. A byte the host interrupts is
+// put back and sent again here, so the main loop never rewinds the
+// ring into stale bytes. Returns 0 if the host sent a command instead,
+// or did not take the byte within a second.
+static uint8_t waitSent(uint8_t idle) {
+    uint32_t start = millisNow();
+    uint8_t done;
 
-    sendNibble(hex & 15);
+    while(1) {
+        if(ps2Error) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ringUnqueue(&sendBuffer);
+            }
+            ps2Error = PS2ERROR_NONE;
+        }
+
+        if(!ringEmpty(receiveBuffer) || millisNow() - start > 1000)
+            return 0;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            done = !ps2Error && (idle ? ps2Idle() : ringEmpty(sendBuffer));
+        }
+
+        if(done)
+            return 1;
+
+        powerIdle();
+    }
+}
+#endif
+
+#ifdef LATENCY
+// Send histograms as raw bytes (not keystrokes), histogram by
+// histogram, and clear them once all are out. Bytes are queued one at
+// a time, as ringUnqueue() on a full ring would make it look empty. If
+// the host sends a command instead or stops taking bytes, gives up and
+// keeps the histograms for the next try.
+void latencyDump() {
+    uint8_t i, j;
+
+    for(i = 0; i < LATENCY_HISTOGRAMS; i++) {
+        for(j = 0; j < LATENCY_BUCKETS; j++) {
+            if(!waitSent(0)) {
+                ringClear(&sendBuffer);
+                return;
+            }
+
+            ringEnqueue(&sendBuffer, latencyHistogram[i][j]);
+        }
+    }
+
+    if(!waitSent(1)) {
+        ringClear(&sendBuffer);
+        return;
+    }
+
+    for(i = 0; i < LATENCY_HISTOGRAMS; i++)
+        for(j = 0; j < LATENCY_BUCKETS; j++)
+            latencyHistogram[i][j] = 0;
+}
+#endif
+
+#ifdef PROFILE
+// Type most significant byte first, followed by a space
+void sendHexValue(uint32_t value, uint8_t bytes) {
+    while(bytes--)
+        sendHex(value >> (8 * bytes));
+
+    sendCode(0x29);
+}
+
+// Type profile table as hex, one line per entry with min, max, call
+// count and total cycles, and a final line with ring drops, PS/2
+// errors, parity errors and ISR overruns. Statistics are cleared
+// afterwards.
+void profileDump() {
+    uint8_t i;
+
+    profileEnabled = 0; // don't measure the dump itself
+
+    for(i = 0; i < PROFILE_ENTRIES; i++) {
+        sendHexValue(profileTable[i].min, 1);
+        sendHexValue(profileTable[i].max, 1);
+        sendHexValue(profileTable[i].calls, 2);
+        sendHexValue(profileTable[i].total, 4);
+        sendCode(0x5A); // enter
+    }
+
+    sendHexValue(profileCounters.ringDrops, 1);
+    sendHexValue(profileCounters.ps2Errors, 1);
+    sendHexValue(profileCounters.parityErrors, 1);
+    sendHexValue(profileCounters.overruns, 1);
+    sendCode(0x5A); // enter
+
+    profileClear();
+    profileEnabled = 1;
 }
 #endif
 
 int main(void) {
     uint16_t adc;
+    uint32_t lastKnock, start;
     uint8_t leds = 0, knocks = 0, state = 0;
+#ifdef PROFILE
+    uint8_t dumpProfile = 0;
+#endif
 
     wdt_enable(WDTO_1S); // Enable watchdog timer to avoid hanging up
 
@@ -62,6 +175,10 @@ int main(void) {
 
     initPS2(); // Initializes timers also
 
+#ifdef POWER_DEBUG_PIN
+    POWER_DEBUG_DDR |= _BV(POWER_DEBUG_PIN);
+#endif
+
 #ifdef LED_PIN
     LED_DDR |= _BV(LED_PIN); // Initialize as output
 
@@ -71,22 +188,26 @@ int main(void) {
 
     // small delay after power-up to avoid sending random
     // stuff if power supply is fluctuating (possible?)
-    for(millis = 0; millis < 3000; )
-        wdt_reset(); 
+    lastKnock = millisNow(); // so first knock is 3s after this
+    waitMillis(3000);
 
 #ifdef LED_PIN
     LED_PORT &= ~_BV(LED_PIN); // OFF
 #endif
 
     while(1) {
-        wdt_reset(); // reset watchdog
+        powerIdle(); // reset watchdog, sleep if possible
+        LATENCY_UPDATE(); // bucket a measurement the interrupt completed
 
 #ifdef USE_BUTTON
-        if(BUTTON_DOWN() && millis > 500) {
+        if(BUTTON_DOWN() && millisNow() - lastKnock > 500) {
 #else // ADC
-        if((adc = adcRead()) > ADC_TRESHOLD && millis > 500) {
+        if((adc = adcRead()) > ADC_TRESHOLD &&
+                millisNow() - lastKnock > 500) {
 #endif
-            if(millis > 3000)
+            LATENCY_MARK(LATENCY_THRESHOLD);
+
+            if(millisNow() - lastKnock > 3000)
                 knocks = 1;
             else
                 knocks++;
@@ -96,12 +217,13 @@ int main(void) {
             // still have pending data in send buffer
             if(knocks >= 3 && ringEmpty(receiveBuffer) &&
                     ringEmpty(sendBuffer)) {
+                LATENCY_MARK(LATENCY_TRIGGER);
                 sendCode(0x29);
                 state = 1; // indicate we're sending
                 knocks = 0;
             }
 
-            millis = 0;
+            lastKnock = millisNow();
         }
 
         if(ps2Error) { // sending data was interrupted
@@ -113,6 +235,7 @@ int main(void) {
                 // a PS/2 command, we can resend stuff just by
                 // setting sendBuffer.read to "zero"
                 sendBuffer.read = sendBuffer.buffer;
+                sendBuffer.dequeued = 0; // nothing to put back now
             }
 
             ps2Error = PS2ERROR_NONE; // resume business
@@ -141,8 +264,7 @@ int main(void) {
                 case PS2_CMD_Reset:
                     SEND_ACK();
                     // will break repeat but so what
-                    for(millis = 0; millis < 10; ) 
-                        wdt_reset();
+                    waitMillis(10);
                     SEND_BAT_OK();
                     break;
 
@@ -156,12 +278,19 @@ int main(void) {
                     // don't store it in minimal version, just use
                     // same code as for typematic rate (ignore value)
                     SEND_ACK();
-                    for(millis = 0; millis < 1000 && // wait 1s max
-                            ringEmpty(receiveBuffer); )
-                        wdt_reset();
+                    start = millisNow();
+                    while(millisNow() - start < 1000 && // wait 1s max
+                            ringEmpty(receiveBuffer))
+                        powerIdle();
 
                     if(!ringEmpty(receiveBuffer) && // received data
                             !IS_PS2_CMD(*receiveBuffer.read)) {
+#ifdef PROFILE
+                        // Turning scroll lock on requests profile dump
+                        if(*receiveBuffer.read & ~leds &
+                                PS2_LED_SCROLL_LOCK)
+                            dumpProfile = 1;
+#endif
                         leds = ringDequeue(&receiveBuffer); // store
                         SEND_ACK();
                     } // else handle normally in next round
@@ -170,9 +299,10 @@ int main(void) {
 
                 case PS2_CMD_Set_Typematic_Rate_Delay:
                     SEND_ACK();
-                    for(millis = 0; millis < 1000 && // wait 1s max
-                            ringEmpty(receiveBuffer); )
-                        wdt_reset();
+                    start = millisNow();
+                    while(millisNow() - start < 1000 && // wait 1s max
+                            ringEmpty(receiveBuffer))
+                        powerIdle();
 
                     if(!ringEmpty(receiveBuffer) && // received data
                             !IS_PS2_CMD(*receiveBuffer.read)) {
@@ -181,6 +311,26 @@ int main(void) {
                     } // else handle normally in next round
                     break;
 
+#ifdef PS2_UPDATE
+                case PS2_CMD_Vendor_Update:
+                    ringClear(&sendBuffer); // not a command to IS_PS2_CMD
+                    SEND_ACK();
+
+                    if(waitSent(1)) // ACK fully sent
+                        bootEnter(); // does not return
+
+                    ringClear(&sendBuffer); // host went on without it
+                    break;
+#endif
+
+#ifdef LATENCY
+                case PS2_CMD_Vendor_Read_Latency:
+                    ringClear(&sendBuffer); // not a command to IS_PS2_CMD
+                    SEND_ACK();
+                    latencyDump();
+                    break;
+#endif
+
                 default:
                     // Most other commands can be adequately emulated
                     // with just acknowledging everything, including
@@ -189,6 +339,13 @@ int main(void) {
                     break;
             }
         }
+
+#ifdef PROFILE
+        if(dumpProfile && ringEmpty(receiveBuffer)) {
+            profileDump();
+            dumpProfile = 0;
+        }
+#endif
     }
 
     return 1;
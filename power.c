@@ -0,0 +1,88 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Low-power idle handling, see power.h for details.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "ps2.h"
+#include "power.h"
+
+#ifdef LOW_POWER
+
+#if !defined(USE_BUTTON) && !defined(__AVR_ATtiny2313__)
+#define POWER_ADC_SLEEP // ADC noise reduction available and useful
+
+#include "adc.h"
+
+// Microseconds slept with timer 0 stopped, not yet added to timebase
+static uint16_t sleptMicros = 0;
+
+// Only enabled during sleep, doubles as timebase catch-up. The
+// conversion started when the CPU halted, and timer 0 was stopped
+// until it completed, so that is exactly one conversion time. If the
+// host wakes us first, the partial conversion (less than
+// ADC_CONVERSION_US) is not counted.
+ISR(ADC_vect) {
+	sleptMicros += ADC_CONVERSION_US;
+
+	while(sleptMicros >= TIMER0_TICK_US) {
+		sleptMicros -= TIMER0_TICK_US;
+		timebaseTick();
+	}
+}
+
+// Only enabled during sleep, just wakes us up
+EMPTY_INTERRUPT(PCINT0_vect);
+#endif
+
+void powerSleep() {
+#ifdef POWER_DEBUG_PIN
+	POWER_DEBUG_PORT &= ~_BV(POWER_DEBUG_PIN); // going to sleep
+#endif
+
+	cli();
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
+#ifdef POWER_ADC_SLEEP
+	PCMSK |= _BV(PS2_CLOCK_PIN); // wake when host pulls clock low
+	GIFR = _BV(PCIF); // forget edges of our own clock
+	GIMSK |= _BV(PCIE);
+
+	// Noise reduction mode needs single conversions and an idle ADC,
+	// a conversion then starts when the CPU halts. Free-running is
+	// left off for good, conversions are started here instead.
+	ADCSRA &= ~_BV(ADATE);
+
+	if(ps2Idle() && ringEmpty(receiveBuffer) &&
+			!(ADCSRA & _BV(ADSC))) {
+		ADCSRA |= _BV(ADIF) | _BV(ADIE); // forget old result, wake on new
+		set_sleep_mode(SLEEP_MODE_ADC);
+	} else
+		ADCSRA |= _BV(ADSC); // keep sampling the sensor while awake
+#endif
+
+	sleep_enable();
+	sei(); // next instruction is still executed before any interrupt
+	sleep_cpu();
+	sleep_disable();
+
+#ifdef POWER_ADC_SLEEP
+	// Our own clock would cause a pin change interrupt every 40 us
+	// and ADC interrupts are not needed when timer 0 is running
+	GIMSK &= ~_BV(PCIE);
+	ADCSRA &= ~_BV(ADIE);
+#endif
+
+#ifdef POWER_DEBUG_PIN
+	POWER_DEBUG_PORT |= _BV(POWER_DEBUG_PIN); // awake
+#endif
+}
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Low-power idle handling. With LOW_POWER defined, the main program
+ * sleeps whenever it would otherwise just spin on wdt_reset():
+ *
+ * - While PS/2 traffic is going on (or with USE_BUTTON / ATtiny2313),
+ *   SLEEP_MODE_IDLE is used. Timers keep running and the 50 kHz timer 0
+ *   tick wakes the CPU, so bus timing is unaffected.
+ * - When the bus is idle and nothing is pending, ADC noise reduction
+ *   mode is used. Both timers stop and the ADC runs one conversion;
+ *   the MCU wakes when it completes (after ADC_CONVERSION_US) or on a
+ *   pin change on the PS/2 clock line. The ADC interrupt advances the
+ *   timebase by the one conversion timer 0 was stopped for.
+ *
+ * Worst case from the host pulling clock low to our first clock edge
+ * is POWER_WAKE_LATENCY_US, checked below against the 10 ms a device
+ * has to start clocking after a host request-to-send. The simulator
+ * (make replay with this flavor selected) reports the longest request
+ * to send to first clock time and the timebase error for a capture.
+ * Define POWER_DEBUG_PIN to drive a pin high while awake: a scope on
+ * it and the clock line shows the wake latency on real hardware, and
+ * its duty cycle D gives average current as
+ * D * I(active) + (1 - D) * I(sleep mode).
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __POWER_H
+#define __POWER_H
+
+#include <avr/wdt.h>
+
+#include "timer.h"
+
+#ifdef LOW_POWER
+
+// Wake-up and pin change interrupt take well under one timer 0 tick.
+// After that cbStillIdle may need a full clock period (4 ticks) to
+// notice clock low, and the first clock edge is generated at most two
+// ticks after the host releases clock for its request-to-send.
+#define POWER_WAKE_LATENCY_US (7 * 1000000L / TIMER0_HZ)
+
+#if POWER_WAKE_LATENCY_US > 10000
+#error "LOW_POWER wake latency exceeds PS/2 host timing limits"
+#endif
+
+// Sleep until next interrupt, in the deepest mode currently safe
+void powerSleep();
+
+#define powerIdle() { wdt_reset(); powerSleep(); }
+
+#else
+
+#define powerIdle() wdt_reset()
+
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Optional cycle profiler, see profile.h for details.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "profile.h"
+#include "timer.h"
+
+#ifdef PROFILE
+
+volatile uint8_t profileEnabled = 1;
+volatile ProfileEntry profileTable[PROFILE_ENTRIES];
+volatile ProfileCounters profileCounters;
+
+#ifdef PROFILE_TIMER1
+volatile uint16_t profileMillis = 0;
+
+ISR(INT_VECT_1) {
+	profileMillis++;
+}
+#endif
+
+// Clear all measurements and counters
+void profileClear() {
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for(i = 0; i < PROFILE_ENTRIES; i++) {
+			profileTable[i].min = profileTable[i].max = 0;
+			profileTable[i].calls = 0;
+			profileTable[i].total = 0;
+		}
+
+		profileCounters.ringDrops = 0;
+		profileCounters.ps2Errors = 0;
+		profileCounters.parityErrors = 0;
+		profileCounters.overruns = 0;
+	}
+}
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Optional cycle profiler. With PROFILE defined, the PS/2 interrupt and
+ * each state machine callback are timed by reading TCNT0 at entry and
+ * exit. With the default 50 kHz tick at 8 MHz timer 0 runs without
+ * prescaler, so the figures are CPU cycles. An entry stops accumulating
+ * after 65535 calls, so the total never overflows.
+ *
+ * PROFILE_TIMER1 brings back the 1 kHz timer 1 millisecond interrupt
+ * the timebase used to have. Comparing PROFILE_LATENCY and PROFILE_ISR
+ * max with and without it shows the jitter that interrupt added to
+ * the PS/2 tick. The host simulator has no cycle model, these figures
+ * only come from hardware.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <avr/io.h>
+
+#include "timer.h"
+
+#ifdef PROFILE
+
+#ifdef MINIMAL
+#error "PROFILE dumps results with sendHex(), not available with MINIMAL"
+#endif
+
+#ifdef __AVR_ATtiny2313__
+#error "PROFILE table does not fit in ATtiny2313 RAM"
+#endif
+
+#ifdef PROFILE_TIMER1
+// Same load as the old timer 1 interrupt, started by initPS2()
+extern volatile uint16_t profileMillis;
+#endif
+
+typedef struct {
+	uint8_t min, max;
+	uint16_t calls;
+	uint32_t total;
+} ProfileEntry;
+
+typedef struct {
+	uint8_t ringDrops; // ringEnqueue() on full ring
+	uint8_t ps2Errors; // sending interrupted by host
+	uint8_t parityErrors; // received bytes with bad parity
+	uint8_t overruns; // ISR ran past the next compare match
+} ProfileCounters;
+
+// Table entries, callbacks follow in PS2Callback declaration order
+#define PROFILE_LATENCY 0 // compare match to ISR entry
+#define PROFILE_ISR 1 // whole TIMER0_COMPA_vect
+#define PROFILE_CALLBACKS 2
+#define PROFILE_CB_IDLE (PROFILE_CALLBACKS + 0)
+#define PROFILE_CB_STILL_IDLE (PROFILE_CALLBACKS + 1)
+#define PROFILE_CB_INHIBIT (PROFILE_CALLBACKS + 2)
+#define PROFILE_CB_SEND_BIT (PROFILE_CALLBACKS + 3)
+#define PROFILE_CB_SEND_PARITY (PROFILE_CALLBACKS + 4)
+#define PROFILE_CB_SEND_STOP_BIT (PROFILE_CALLBACKS + 5)
+#define PROFILE_CB_RECEIVE_BIT (PROFILE_CALLBACKS + 6)
+#define PROFILE_CB_RECEIVE_PARITY (PROFILE_CALLBACKS + 7)
+#define PROFILE_CB_RECEIVE_ACK (PROFILE_CALLBACKS + 8)
+#define PROFILE_CB_RECEIVE_END (PROFILE_CALLBACKS + 9)
+#define PROFILE_ENTRIES (PROFILE_CALLBACKS + 10)
+
+extern volatile uint8_t profileEnabled;
+extern volatile ProfileEntry profileTable[PROFILE_ENTRIES];
+extern volatile ProfileCounters profileCounters;
+
+// Timer 0 counts from start to end, at most one compare match apart.
+// In CTC mode the counter wraps after TIMER0_OCR, not after 255. Pass
+// TCNT0 latched in a local, not the register itself.
+static inline uint8_t profileCycles(uint8_t start, uint8_t end) {
+	return end < start ? end + (TIMER0_OCR + 1) - start : end - start;
+}
+
+// Add one measurement to table entry, only when profileEnabled. Inline
+// so the interrupt handler does not save registers for calls.
+static inline void profileRecord(uint8_t entry, uint8_t cycles) {
+	volatile ProfileEntry *p = profileTable + entry;
+
+	if(!profileEnabled || p->calls == 0xFFFF)
+		return;
+
+	if(!p->calls || cycles < p->min)
+		p->min = cycles;
+
+	if(cycles > p->max)
+		p->max = cycles;
+
+	p->calls++;
+	p->total += cycles;
+}
+
+// Clear all measurements and counters
+void profileClear();
+
+#define PROFILE_COUNT(counter) (profileCounters.counter++)
+
+#else
+
+#define PROFILE_COUNT(counter)
+
+#ifdef PROFILE_TIMER1
+#error "PROFILE_TIMER1 needs PROFILE"
+#endif
+
+#endif
+
+#endif
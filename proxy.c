@@ -0,0 +1,111 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Keyboard-to-keyboard proxy main program. A real keyboard is connected
+ * to the host side pins and the PC to the device side pins. Scan codes
+ * from the keyboard are remapped and queued for the PC as soon as their
+ * stop bit arrives, so the device side is already sending a byte while
+ * the next one is coming in. Added latency should thus be about one byte
+ * time (11 clocks) plus at most one PS/2 clock period for the device
+ * side to notice the queued byte, "make replay" with this flavor
+ * measures it against a simulated keyboard. Commands from the PC are
+ * passed through.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "ps2config.h"
+#include "ring.h"
+#include "ps2.h"
+#include "ps2host.h"
+
+#ifndef PS2_PROXY
+#error "Build proxy.c with PS2_PROXY defined, see Makefile"
+#endif
+
+// Scan code set 2 remapping table, also applies to the byte after an
+// E0 or F0 prefix. Don't remap 0x83, 0xAA, 0xAB, 0xEE, 0xFA or 0xFE,
+// keyboards use those values for command responses.
+#define REMAPS 1
+
+static prog_uint8_t remapFrom[REMAPS] = { 0x58 }; // Caps Lock...
+static prog_uint8_t remapTo[REMAPS] = { 0x14 }; // ...is Left Ctrl
+
+uint8_t remap(uint8_t code) {
+    uint8_t i;
+
+    for(i = 0; i < REMAPS; i++)
+        if(pgm_read_byte(&remapFrom[i]) == code)
+            return pgm_read_byte(&remapTo[i]);
+
+    return code;
+}
+
+// Free slots in send buffer
+uint8_t sendRoom() {
+    int8_t room = sendBuffer.read - sendBuffer.write - 1;
+
+    if(room < 0)
+        room += RING_SIZE;
+
+    return room;
+}
+
+int main(void) {
+    uint8_t byte;
+
+    wdt_enable(WDTO_1S); // Enable watchdog timer to avoid hanging up
+
+    initPS2Host();
+    initPS2(); // Initializes timers also
+
+    while(1) {
+        wdt_reset(); // reset watchdog
+
+        // Keyboard to PC. One slot is kept free, as ringUnqueue() on
+        // resend would make a completely full ring look empty.
+        while(!ringEmpty(hostReceiveBuffer) && sendRoom() > 1)
+            ringEnqueue(&sendBuffer,
+                    remap(ringDequeue(&hostReceiveBuffer)));
+
+        ps2HostResume(); // in case keyboard was inhibited or stalled
+
+        if(ps2HostError) {
+            // On send errors the PC will time out and retry by itself
+            if(ps2HostError == PS2HOSTERROR_RECEIVE)
+                ps2HostSend(PS2_CMD_Resend);
+
+            ps2HostError = PS2HOSTERROR_NONE;
+        }
+
+        // PC interrupted us, send that byte again. No-op if a resend
+        // request (0xFE) already put it back, or a command cleared it.
+        if(ps2Error) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ringUnqueue(&sendBuffer);
+            }
+            ps2Error = PS2ERROR_NONE; // resume business
+        }
+
+        // PC to keyboard. Resend (0xFE) is handled by PS2 code
+        // internally from our send buffer.
+        while(!ringEmpty(receiveBuffer)) {
+            if(IS_PS2_CMD(*receiveBuffer.read))
+                ringClear(&sendBuffer); // like keyboard does on command
+
+            byte = ringDequeue(&receiveBuffer);
+
+            if(byte == PS2_Receive_Error) // ask PC to send it again
+                SEND_ERROR();
+            else
+                ps2HostSend(byte);
+        }
+    }
+
+    return 1;
+}
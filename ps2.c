@@ -9,12 +9,16 @@
  */
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "ps2.h"
 #include "timer.h"
+#include "profile.h"
+#include "latency.h"
 
-// Free-running milliseconds counter
-volatile uint16_t millis = 0;
+// Free-running timebase, advanced by the PS/2 tick
+volatile uint32_t millisCount = 0;
+volatile uint8_t millisTicks = 0;
 volatile PS2Error ps2Error = PS2ERROR_NONE;
 
 // PS/2 send and receive buffers
@@ -27,16 +31,43 @@ void initPS2() {
 	ringClear(&sendBuffer); // clear ring
 	ringClear(&receiveBuffer); // clear ring
 
-	startTimer_0(50000L); // 50 kHz for clock generation
-	startTimer_1(1000L); // 1 kHz for millisecond counting
+	startTimer_0(); // 50 kHz for clock generation and timebase
+#ifdef PROFILE_TIMER1
+	startTimer_1(); // competing interrupt, see profile.h
+#endif
 
     sei(); //  enable global interrupts
 }
 
-// 1000 Hz counter and clock logic
-ISR(INT_VECT_1) { 
-	millis++;
+// Atomic snapshot of milliseconds since power-up
+uint32_t millisNow() {
+	uint32_t ms;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = millisCount;
+	}
+
+	return ms;
+}
+
+#ifdef LATENCY
+// Microseconds since power-up of a raw snapshot
+uint32_t timestampMicros(const Timestamp *t) {
+	return t->ms * 1000 + t->ticks * TIMER0_TICK_US +
+		(uint16_t)t->count * TIMER0_PRESCALE / (F_CPU / 1000000L);
+}
+
+// Atomic snapshot of microseconds since power-up, wraps in ~71 minutes
+uint32_t microsNow() {
+	Timestamp t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timestampNow(&t);
+	}
+
+	return timestampMicros(&t);
 }
+#endif
 
 // PS/2 driver state machine starts here
 static volatile uint8_t generateClock = 0;
@@ -57,16 +88,43 @@ void *cbReceiveParity();
 void *cbReceiveAck();
 void *cbReceiveEnd();
 
+static volatile PS2Callback cbCurrent = cbIdle;
+
+#ifdef PROFILE
+// Profile table entry of the callback running, set by each callback
+static uint8_t profileId;
+#define PROFILE_ID(id) (profileId = (id))
+
+// Run current callback and record the cycles it took
+static inline void profileCallback() {
+	uint8_t start = TCNT0, end;
+
+	cbCurrent = (PS2Callback)(*cbCurrent)();
+	end = TCNT0;
+	profileRecord(profileId, profileCycles(start, end));
+}
+#else
+#define PROFILE_ID(id)
+#endif
+
 // 50 kHz, 20 us between calls
 ISR(TIMER0_COMPA_vect) {
 	static uint8_t clockPhase = 1;
-	static PS2Callback cbCurrent = cbIdle;
+#ifdef PROFILE
+	uint8_t entry = TCNT0, end, wrapped; // counts since compare match
+#endif
 
 	//sei(); // only callbacks take long and they take less than 4 calls
 
+	timebaseTick(); // first, so timestamps taken by callbacks are right
+
 	if(clockPhase & 1) { // Middle of high/low
 		if(clockPhase & 2) // High
+#ifdef PROFILE
+			profileCallback();
+#else
 			cbCurrent = (PS2Callback)(*cbCurrent)();
+#endif
 	} else if(generateClock) { // Transition
 		// generateClock is only modified on clock high so additional
 		// safeguards for clock left low shouldn't be necessary
@@ -77,10 +135,37 @@ ISR(TIMER0_COMPA_vect) {
 	} 
 
 	clockPhase++;
+
+#ifdef PROFILE
+	// Flag first: if it is set, end is surely past the wrap, and a wrap
+	// right after reading it is still caught by profileCycles()
+	wrapped = TIFR & _BV(OCF0A);
+	end = TCNT0;
+
+	profileRecord(PROFILE_LATENCY, entry);
+
+	if(wrapped) { // ran into the next tick, counter wrapped
+		uint16_t cycles = end + (TIMER0_OCR + 1) - entry;
+
+		PROFILE_COUNT(overruns);
+		profileRecord(PROFILE_ISR, cycles > 255 ? 255 : cycles);
+	} else
+		profileRecord(PROFILE_ISR, profileCycles(entry, end));
+#endif
 }
 
+#if defined(LOW_POWER) || defined(LATENCY) || defined(PS2_UPDATE)
+// Nothing on the bus and nothing to send, call with interrupts disabled
+uint8_t ps2Idle() {
+	return cbCurrent == cbStillIdle && !generateClock &&
+		ringEmpty(sendBuffer) && isClockHigh();
+}
+#endif
+
 // We should be idle (and not holding either data or clock line)
 void *cbIdle() {
+	PROFILE_ID(PROFILE_CB_IDLE);
+
 	generateClock = 0;
 
 	if(isClockLow())
@@ -91,6 +176,8 @@ void *cbIdle() {
 
 // We were idle last time, and still are
 void *cbStillIdle() {
+	PROFILE_ID(PROFILE_CB_STILL_IDLE);
+
 	if(isClockLow())
 		return cbInhibit;
 
@@ -105,11 +192,18 @@ void *cbStillIdle() {
 	stateParity = 0;
 	stateBits = 8;
 
+#ifdef LATENCY
+	if(ringEmpty(sendBuffer)) // last byte queued
+		LATENCY_MARK(LATENCY_START_BIT);
+#endif
+
 	return cbSendBit;
 }
 
 // Clock line was held low last time
 void *cbInhibit() {
+	PROFILE_ID(PROFILE_CB_INHIBIT);
+
 	if(isClockLow()) // still held low
 		return cbInhibit;
 
@@ -126,9 +220,12 @@ void *cbInhibit() {
 
 // Send bit
 void *cbSendBit() {
+	PROFILE_ID(PROFILE_CB_SEND_BIT);
+
 	if(isClockLow()) {
 		releaseData(); // make sure data is released
 		ps2Error = PS2ERROR_INTERRUPTED;
+		PROFILE_COUNT(ps2Errors);
 		return cbInhibit;
 	}
 
@@ -148,9 +245,12 @@ void *cbSendBit() {
 
 // Send parity bit
 void *cbSendParity() {
+	PROFILE_ID(PROFILE_CB_SEND_PARITY);
+
 	if(isClockLow()) {
 		releaseData(); // make sure data is released
 		ps2Error = PS2ERROR_INTERRUPTED;
+		PROFILE_COUNT(ps2Errors);
 		return cbInhibit;
 	}
 
@@ -164,15 +264,21 @@ void *cbSendParity() {
 
 // Send stop bit
 void *cbSendStopBit() {
+	PROFILE_ID(PROFILE_CB_SEND_STOP_BIT);
+
 	// No need to worry about clock being held low anymore
 
 	releaseData(); // Just release data (1)
 
+	LATENCY_MARK(LATENCY_STOP_BIT);
+
 	return cbIdle;
 }
 
 // Receive one bit
 void *cbReceiveBit() {
+	PROFILE_ID(PROFILE_CB_RECEIVE_BIT);
+
 	stateByte >>= 1;
 
 	if(isDataHigh()) {
@@ -188,6 +294,8 @@ void *cbReceiveBit() {
 
 // Receive parity
 void *cbReceiveParity() {
+	PROFILE_ID(PROFILE_CB_RECEIVE_PARITY);
+
 	if(isDataHigh())
 		stateParity++;
 
@@ -196,6 +304,8 @@ void *cbReceiveParity() {
 
 // Send ACK 
 void *cbReceiveAck() {
+	PROFILE_ID(PROFILE_CB_RECEIVE_ACK);
+
 	if(isDataLow()) // data NOT released
 		return cbReceiveAck; // generate clock pulses until released
 
@@ -206,15 +316,22 @@ void *cbReceiveAck() {
 			ringUnqueue(&sendBuffer); // resend last sent byte
 		else // normal operation
 			ringEnqueue(&receiveBuffer, stateByte); // store
-	} else
+	} else {
 		ringEnqueue(&receiveBuffer, PS2_Receive_Error);
+		PROFILE_COUNT(parityErrors);
+	}
 
 	return cbReceiveEnd;
 }
 
 // End receiving
 void *cbReceiveEnd() {
+	void *next;
+
 	releaseData();
 
-	return cbIdle(); // avoid code duplication
+	next = cbIdle(); // avoid code duplication
+	PROFILE_ID(PROFILE_CB_RECEIVE_END); // after the one cbIdle() set
+
+	return next;
 }
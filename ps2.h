@@ -10,8 +10,11 @@
 #ifndef __PS2_H
 #define __PS2_H
 
+#include <util/atomic.h>
+
 #include "ps2config.h"
 #include "ring.h"
+#include "timer.h"
 
 #define PS2_LED_SCROLL_LOCK 1
 #define PS2_LED_NUM_LOCK 2
@@ -22,8 +25,12 @@ typedef enum {
 	PS2ERROR_INTERRUPTED = 1
 } PS2Error;
 
-// Free-running milliseconds counter
-extern volatile uint16_t millis;
+// Free-running timebase, advanced by the PS/2 tick. Use millisNow()
+// and microsNow() instead of reading these directly. The microsecond
+// functions and ps2Idle() are only built for the flavors that use them,
+// there is no section garbage collection to drop them otherwise.
+extern volatile uint32_t millisCount;
+extern volatile uint8_t millisTicks;
 extern volatile PS2Error ps2Error;
 
 // PS/2 send and receive buffers
@@ -31,6 +38,51 @@ extern volatile RingBuffer sendBuffer, receiveBuffer;
 
 void initPS2();
 
+// Atomic snapshot of milliseconds since power-up
+uint32_t millisNow();
+
+#ifdef LATENCY
+// Atomic snapshot of microseconds since power-up, wraps in ~71 minutes
+uint32_t microsNow();
+#endif
+
+// Raw timebase snapshot, cheap enough for interrupts. Convert with
+// timestampMicros() later.
+typedef struct {
+	uint32_t ms;
+	uint8_t ticks, count;
+} Timestamp;
+
+// Take a raw snapshot, call with interrupts disabled
+static inline void timestampNow(Timestamp *t) {
+	t->ms = millisCount;
+	t->ticks = millisTicks;
+	t->count = TCNT0;
+
+	if(TIFR & _BV(OCF0A)) { // counter wrapped, tick not yet counted
+		t->count = TCNT0; // surely after the wrap now
+		t->ticks++;
+	}
+}
+
+#ifdef LATENCY
+// Microseconds since power-up of a raw snapshot
+uint32_t timestampMicros(const Timestamp *t);
+#endif
+
+// Advance timebase by one PS/2 tick, call with interrupts disabled
+static inline void timebaseTick() {
+	if(++millisTicks == TIMER0_TICKS_PER_MS) {
+		millisTicks = 0;
+		millisCount++;
+	}
+}
+
+#if defined(LOW_POWER) || defined(LATENCY) || defined(PS2_UPDATE)
+// Nothing on the bus and nothing to send, call with interrupts disabled
+uint8_t ps2Idle();
+#endif
+
 #define isClockHigh() (PS2_CLOCK_INPUT & (1 << PS2_CLOCK_PIN))
 #define isClockLow() (!isClockHigh())
 
@@ -79,6 +131,11 @@ static inline void holdData() {
 #define PS2_CMD_Echo 0xEE
 #define PS2_CMD_Set_Reset_LEDs 0xED
 
+// Vendor commands, not sent to keyboards by standard hosts. These are
+// below PS2_CMD_Echo so IS_PS2_CMD() is false for them.
+#define PS2_CMD_Vendor_Read_Latency 0xE1
+#define PS2_CMD_Vendor_Update 0xE2 // see boot.h
+
 // Send default PS/2 responses
 #define SEND_ACK() ringEnqueue(&sendBuffer, 0xFA)
 #define SEND_ERROR() ringEnqueue(&sendBuffer, 0xFE)
@@ -90,7 +147,10 @@ static inline void holdData() {
 #define MAKE_SPACE() ringEnqueue(&sendBuffer, 0x29)
 #define MAKE_CODE(code) ringEnqueue(&sendBuffer, (code))
 
-#define BREAK_SPACE() { ringEnqueue(&sendBuffer, 0xF0); ringEnqueue(&sendBuffer, 0x29); }
-#define BREAK_CODE(code) { ringEnqueue(&sendBuffer, 0xF0); ringEnqueue(&sendBuffer, (code)); }
+// Both bytes are queued at once, so the PS/2 interrupt never sees only
+// 0xF0 queued and takes it for the last byte (see LATENCY_START_BIT)
+#define BREAK_SPACE() BREAK_CODE(0x29)
+#define BREAK_CODE(code) ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { \
+	ringEnqueue(&sendBuffer, 0xF0); ringEnqueue(&sendBuffer, (code)); }
 
 #endif
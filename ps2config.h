@@ -22,6 +22,20 @@
 #define PS2_DATA_PIN 1
 #define PS2_DATA_INPUT PINB
 
+// Keyboard connected to the host side (PS2_PROXY only), the pins
+// must be on port B so pin change interrupt covers the clock line
+#ifdef PS2_PROXY
+#define PS2_HOST_CLOCK_DDR DDRB
+#define PS2_HOST_CLOCK_PORT PORTB
+#define PS2_HOST_CLOCK_PIN 2
+#define PS2_HOST_CLOCK_INPUT PINB
+
+#define PS2_HOST_DATA_DDR DDRB
+#define PS2_HOST_DATA_PORT PORTB
+#define PS2_HOST_DATA_PIN 3
+#define PS2_HOST_DATA_INPUT PINB
+#endif
+
 // We can have either button press trigger space, or else
 // ADC going above treshold (e.g. piezo vibration trigger)
 #ifdef USE_BUTTON
@@ -37,4 +51,10 @@
 #define LED_MASK 4 // 4=caps 2=num 1=scroll
 #endif
 
+// Optional pin driven high while awake, for LOW_POWER measurements
+#ifdef POWER_DEBUG_PIN
+#define POWER_DEBUG_PORT PORTB
+#define POWER_DEBUG_DDR DDRB
+#endif
+
 #endif
@@ -0,0 +1,229 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * PS/2 host side implementation.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+
+#include "ps2.h"
+#include "ps2host.h"
+
+#ifdef LOW_POWER
+#error "LOW_POWER uses the pin change interrupt for wake-up"
+#endif
+
+#ifdef PCINT0_vect
+#define HOST_VECT PCINT0_vect
+#else
+#define HOST_VECT PCINT_vect // ATtiny2313
+#endif
+
+// Keyboard must start clocking within 15 ms of request to send and
+// finish in 2 ms more, give up on it after this
+#define HOST_SEND_TIMEOUT_MS 20
+
+// Clock edges of a frame are at most 100 us apart. A keyboard frame
+// still incomplete after this lost an edge or was aborted, drop it.
+#define HOST_FRAME_TIMEOUT_MS 2
+
+volatile PS2HostError ps2HostError = PS2HOSTERROR_NONE;
+
+// Bytes received from the keyboard
+volatile RingBuffer hostReceiveBuffer;
+
+// PS/2 host state machine starts here
+static volatile uint8_t hostInhibit = 0;
+static volatile uint8_t hostBits = 0, hostParity = 0, hostByte = 0;
+static volatile uint8_t hostEdge = 0; // low byte of millisCount
+
+typedef void *(*PS2HostCallback)();
+
+void *hcbIdle();
+
+void *hcbSendBit();
+void *hcbSendParity();
+void *hcbSendStopBit();
+void *hcbSendAck();
+
+void *hcbReceiveBit();
+void *hcbReceiveParity();
+void *hcbReceiveStopBit();
+
+static volatile PS2HostCallback hcbCurrent = hcbIdle;
+
+void initPS2Host() {
+	releaseHostClock();
+	releaseHostData();
+
+	ringClear(&hostReceiveBuffer); // clear ring
+
+	PCMSK |= _BV(PS2_HOST_CLOCK_PIN);
+	GIMSK |= _BV(PCIE);
+}
+
+// Data is valid (keyboard to host) or can be changed (host to keyboard)
+// while clock is low, so only falling edges matter
+ISR(HOST_VECT) {
+	if(isHostClockLow()) {
+		hostEdge = millisCount;
+		hcbCurrent = (PS2HostCallback)(*hcbCurrent)();
+	}
+}
+
+// Back to idle if a keyboard frame has stalled. Sends are left to the
+// timeout in ps2HostSend(), the first clock may take 15 ms.
+static void hostFrameTimeout() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if((hcbCurrent == hcbReceiveBit ||
+				hcbCurrent == hcbReceiveParity ||
+				hcbCurrent == hcbReceiveStopBit) &&
+				(uint8_t)(millisCount - hostEdge) > HOST_FRAME_TIMEOUT_MS)
+			hcbCurrent = hcbIdle;
+	}
+}
+
+// Send byte to keyboard, waits until the previous transfer is done
+void ps2HostSend(uint8_t byte) {
+	uint32_t start = millisNow();
+
+	while(hcbCurrent != hcbIdle) { // receiving, or previous send
+		wdt_reset();
+		hostFrameTimeout();
+
+		if(millisNow() - start > HOST_SEND_TIMEOUT_MS) {
+			ps2HostError = PS2HOSTERROR_SEND;
+			break; // keyboard went away, just start over
+		}
+	}
+
+	// Hold clock for 100 us to request send, this also aborts any
+	// transfer the keyboard started meanwhile (it will resend)
+	GIMSK &= ~_BV(PCIE); // our own clock edges are of no interest
+	holdHostClock();
+	_delay_us(100);
+	holdHostData(); // Start bit (0)
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		hostByte = byte;
+		hostParity = 0;
+		hostBits = 8;
+		hcbCurrent = hcbSendBit;
+	}
+
+	GIFR = _BV(PCIF); // forget edges we caused
+	GIMSK |= _BV(PCIE);
+
+	releaseHostClock(); // keyboard clocks the rest in
+}
+
+// Stop inhibiting the keyboard once there is room in receive buffer
+void ps2HostResume() {
+	hostFrameTimeout();
+
+	if(hostInhibit && !ringFull(hostReceiveBuffer) &&
+			hcbCurrent == hcbIdle) {
+		hostInhibit = 0;
+		releaseHostClock();
+	}
+}
+
+// Waiting for start bit from keyboard
+void *hcbIdle() {
+	if(isHostDataHigh()) // not a start bit, e.g. our own inhibit
+		return hcbIdle;
+
+	hostParity = 0;
+	hostBits = 8;
+
+	return hcbReceiveBit;
+}
+
+// Send bit
+void *hcbSendBit() {
+	if(hostByte & 1) {
+		hostParity++;
+		releaseHostData();
+	} else
+		holdHostData();
+
+	hostByte >>= 1;
+
+	if(--hostBits)
+		return hcbSendBit;
+
+	return hcbSendParity;
+}
+
+// Send parity bit
+void *hcbSendParity() {
+	if(hostParity & 1)
+		holdHostData(); // send zero for odd parity
+	else
+		releaseHostData();
+
+	return hcbSendStopBit;
+}
+
+// Send stop bit
+void *hcbSendStopBit() {
+	releaseHostData(); // Just release data (1)
+
+	return hcbSendAck;
+}
+
+// Keyboard acknowledges by holding data low for the last clock
+void *hcbSendAck() {
+	if(isHostDataHigh())
+		ps2HostError = PS2HOSTERROR_SEND;
+
+	if(hostInhibit) // receive buffer still full, keep keyboard quiet
+		holdHostClock();
+
+	return hcbIdle;
+}
+
+// Receive one bit
+void *hcbReceiveBit() {
+	hostByte >>= 1;
+
+	if(isHostDataHigh()) {
+		hostByte |= 0x80;
+		hostParity++;
+	}
+
+	if(--hostBits)
+		return hcbReceiveBit;
+
+	return hcbReceiveParity;
+}
+
+// Receive parity
+void *hcbReceiveParity() {
+	if(isHostDataHigh())
+		hostParity++;
+
+	return hcbReceiveStopBit;
+}
+
+// Receive stop bit, the byte is available right away
+void *hcbReceiveStopBit() {
+	if(isHostDataHigh() && (hostParity & 1)) {
+		ringEnqueue(&hostReceiveBuffer, hostByte);
+
+		if(ringFull(hostReceiveBuffer)) { // inhibit until room
+			hostInhibit = 1;
+			holdHostClock();
+		}
+	} else
+		ps2HostError = PS2HOSTERROR_RECEIVE;
+
+	return hcbIdle;
+}
@@ -0,0 +1,70 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * PS/2 host side implementation, for talking to a real keyboard. The
+ * keyboard drives the clock, so instead of a timer the state machine
+ * runs from a pin change interrupt on each falling clock edge.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __PS2HOST_H
+#define __PS2HOST_H
+
+#include "ps2config.h"
+#include "ring.h"
+
+#ifndef PS2_HOST_CLOCK_PIN
+#error "PS/2 host side pins not configured, see ps2config.h"
+#endif
+
+typedef enum {
+	PS2HOSTERROR_NONE = 0,
+	PS2HOSTERROR_RECEIVE = 1, // bad parity or stop bit
+	PS2HOSTERROR_SEND = 2 // keyboard did not clock or acknowledge
+} PS2HostError;
+
+extern volatile PS2HostError ps2HostError;
+
+// Bytes received from the keyboard
+extern volatile RingBuffer hostReceiveBuffer;
+
+void initPS2Host();
+
+// Send byte to keyboard, waits until the previous transfer is done
+void ps2HostSend(uint8_t byte);
+
+// Stop inhibiting the keyboard once there is room in receive buffer.
+// Also drops a keyboard frame that has had no clock edge for 2 ms, so
+// call it from the main loop regularly.
+void ps2HostResume();
+
+#define isHostClockHigh() \
+	(PS2_HOST_CLOCK_INPUT & (1 << PS2_HOST_CLOCK_PIN))
+#define isHostClockLow() (!isHostClockHigh())
+
+#define isHostDataHigh() (PS2_HOST_DATA_INPUT & (1 << PS2_HOST_DATA_PIN))
+#define isHostDataLow() (!isHostDataHigh())
+
+static inline void releaseHostClock() {
+	PS2_HOST_CLOCK_DDR &= ~_BV(PS2_HOST_CLOCK_PIN); // set as input
+	PS2_HOST_CLOCK_PORT |= _BV(PS2_HOST_CLOCK_PIN); // set pullup
+}
+
+static inline void holdHostClock() {
+	PS2_HOST_CLOCK_PORT &= ~_BV(PS2_HOST_CLOCK_PIN); // zero output value
+	PS2_HOST_CLOCK_DDR |= _BV(PS2_HOST_CLOCK_PIN); // set as output
+}
+
+static inline void releaseHostData() {
+	PS2_HOST_DATA_DDR &= ~_BV(PS2_HOST_DATA_PIN); // set as input
+	PS2_HOST_DATA_PORT |= _BV(PS2_HOST_DATA_PIN); // set pullup
+}
+
+static inline void holdHostData() {
+	PS2_HOST_DATA_PORT &= ~_BV(PS2_HOST_DATA_PIN); // zero output value
+	PS2_HOST_DATA_DDR |= _BV(PS2_HOST_DATA_PIN); // set as output
+}
+
+#endif
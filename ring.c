@@ -11,10 +11,12 @@
  * See README.md or http://codeandlife/?p=1488 for details.
  */
 #include "ring.h"
+#include "profile.h"
 
 // Initialize / clear ring
 void ringClear(volatile RingBuffer *ring) {
 	ring->read = ring->write = ring->buffer;
+	ring->dequeued = 0;
 }
 
 // Dequeue item. Call only if ring is not empty!
@@ -26,6 +28,8 @@ uint8_t ringDequeue(volatile RingBuffer *ring) {
 	if(++ring->read == ringEnd(*ring))
 		ring->read = ring->buffer; // wrap
 
+	ring->dequeued = 1;
+
 	return val;
 }
 
@@ -36,8 +40,10 @@ uint8_t ringEnqueue(volatile RingBuffer *ring, uint8_t byte) {
 	if(nextWrite == ringEnd(*ring))
 		nextWrite = ring->buffer; // wrap
 
-	if(nextWrite == ring->read) // unacceptable - ring full
+	if(nextWrite == ring->read) { // unacceptable - ring full
+		PROFILE_COUNT(ringDrops);
 		return 0;
+	}
 
 	*ring->write = byte;
 	ring->write = nextWrite;
@@ -45,8 +51,15 @@ uint8_t ringEnqueue(volatile RingBuffer *ring, uint8_t byte) {
 	return 1;
 }
 
-// Revert ringDequeue by putting back last dequeued byte to front
+// Revert ringDequeue by putting back last dequeued byte to front. Only
+// once per dequeue, so an interrupted send followed by a resend request
+// for the same byte does not step back twice.
 void ringUnqueue(volatile RingBuffer *ring) {
+	if(!ring->dequeued)
+		return; // already put back, or cleared since
+
+	ring->dequeued = 0;
+
 	if(ring->read != ring->buffer)
 		ring->read--; // still room
 	else
@@ -21,10 +21,13 @@
 typedef struct {
 	volatile uint8_t buffer[RING_SIZE];
 	volatile uint8_t *read, *write;
+	volatile uint8_t dequeued; // last dequeued item can be put back
 } RingBuffer;
 
 // Macros operate on actual struct, not pointer
 #define ringEmpty(r) ((r).read == (r).write)
+#define ringFull(r) ((r).write + 1 == ((r).read == (r).buffer ? \
+			ringEnd(r) : (r).read))
 
 // This makes use of the fact that struct is likely non-packed and linear
 #define ringEnd(r) ((uint8_t *)(&(r).read))
@@ -35,7 +38,7 @@ void ringClear(volatile RingBuffer *ring);
 // Dequeue item. Call only if ring is not empty!
 uint8_t ringDequeue(volatile RingBuffer *ring);
 
-// Put last dequed item back, if possible
+// Put last dequeued item back, once, and not after ringClear()
 void ringUnqueue(volatile RingBuffer *ring);
 
 // Add item to end of queue, if possible, returns 1 on success
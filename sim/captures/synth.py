@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+#
+# PS/2 keyboard implementation and knock sensor.
+# Synthetic PS/2 captures for sim/replay.c, as a logic analyzer would
+# record them from a real host and keyboard (D0/PS2_CLK clock, D1/PS2_DATA
+# data). Bit timing is nominal: 12.5 kHz keyboard clock, 100 us host
+# request to send.
+#
+#   resend       reset, set LEDs with a host resend request (0xFE) and a
+#                keyboard resend request, host inhibit before the BAT
+#   interrupted  reset, then a keyboard ACK the host interrupts after
+#                four bits and that the keyboard sends again
+#
+# Usage: synth.py resend|interrupted csv|vcd [samplerate]
+#
+#   python3 sim/captures/synth.py resend vcd > sim/captures/resend.vcd
+#   python3 sim/captures/synth.py interrupted csv > sim/captures/interrupted.csv
+#
+# Copyright (C) Joonas Pihlajamaa 2013.
+# Licensed under GNU GPL v3, see LICENSE for details.
+#
+# See README.md or http://codeandlife/?p=1488 for details.
+#
+import sys
+
+events = []  # (time in us, clock, data)
+now = 0
+clock = data = 1
+
+def parity(byte):
+    return 1 ^ (bin(byte).count('1') & 1)
+
+def level(c=None, d=None):
+    global clock, data
+    if c is not None:
+        clock = c
+    if d is not None:
+        data = d
+    events.append((now, clock, data))
+
+def wait(us):
+    global now
+    now += us
+
+# Keyboard to host, first bits only if count is given
+def keyboard(byte, count=11):
+    bits = [0] + [(byte >> i) & 1 for i in range(8)] + [parity(byte), 1]
+    for bit in bits[:count]:
+        level(d=bit); wait(20); level(c=0); wait(40); level(c=1); wait(20)
+    if count < 11:
+        level(d=1)
+    else:
+        wait(100)
+
+# Host to keyboard, request to send, keyboard clocks and acknowledges
+def host(byte):
+    level(c=0); wait(110); level(d=0); wait(10); level(c=1); wait(300)
+    bits = [(byte >> i) & 1 for i in range(8)] + [parity(byte), 1]
+    for bit in bits:
+        level(c=0); wait(10); level(d=bit); wait(30); level(c=1); wait(40)
+    level(c=0, d=0); wait(40); level(c=1, d=1); wait(500)
+
+def inhibit(us):
+    level(c=0); wait(us); level(c=1); wait(100)
+
+def resend():
+    host(0xFF); wait(100); inhibit(1500); wait(500)
+    keyboard(0xFA); wait(9000); keyboard(0xAA); wait(5000)
+    host(0xED); keyboard(0xFA); wait(2000)
+    host(0xFE); keyboard(0xFA); wait(3000)
+    host(0x07); keyboard(0xFE); host(0x07); keyboard(0xFA); wait(50000)
+
+def interrupted():
+    host(0xFF); keyboard(0xFA); wait(9000); keyboard(0xAA); wait(5000)
+    host(0xED); wait(1100); keyboard(0xFA, 4); inhibit(1000); wait(200)
+    keyboard(0xFA); wait(50000)
+
+if len(sys.argv) < 3 or sys.argv[1] not in ('resend', 'interrupted') or \
+        sys.argv[2] not in ('csv', 'vcd'):
+    sys.exit("usage: synth.py resend|interrupted csv|vcd [samplerate]")
+
+level(); wait(1000)
+globals()[sys.argv[1]]()
+level()
+
+if sys.argv[2] == 'csv':  # sigrok-cli style, one sample per line
+    rate = int(sys.argv[3]) if len(sys.argv) > 3 else 100000
+    step = 1000000 // rate
+    print("; CSV generated by sigrok-cli")
+    print("; Channels (2/8): D0, D1")
+    print("; Samplerate: %d kHz" % (rate // 1000))
+    print("logic,logic")
+    i = 0
+    for sample in range(now // step):
+        while i + 1 < len(events) and events[i + 1][0] <= sample * step:
+            i += 1
+        print("%d,%d" % events[i][1:])
+else:  # value changes only
+    print("$timescale 1 us $end")
+    print("$scope module logic $end")
+    print("$var wire 1 ! PS2_CLK $end")
+    print("$var wire 1 \" PS2_DATA $end")
+    print("$upscope $end")
+    print("$enddefinitions $end")
+    for t, c, d in events:
+        print("#%d\n%d!\n%d\"" % (t, c, d))
@@ -0,0 +1,205 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Simulated PS/2 host on the device pins, see sim.h. Sends bytes and
+ * inhibits when told to, receives whatever the firmware sends, and
+ * checks the firmware against the PS/2 device timing limits.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <stddef.h>
+
+#include "../ps2.h"
+#include "sim.h"
+
+// Host side timing limits from the PS/2 specification, microseconds
+#define HOST_RTS_MIN_US 100 // request to send clock hold
+#define HOST_CLOCK_TIMEOUT_US 15000 // device must start clocking
+#define HOST_TRANSFER_US 2000 // and clock the byte in this time
+#define DEVICE_HALF_MIN_US 30 // 16.7 kHz
+#define DEVICE_HALF_MAX_US 50 // 10 kHz
+#define DEVICE_START_DELAY_US 50 // after clock is released
+#define FRAME_GAP_US 1000 // longer pause between edges ends a frame
+
+typedef enum {
+	HOST_IDLE,
+	HOST_HOLD, // inhibit or request to send, clock held low
+	HOST_SEND // device clocking our byte in
+} HostState;
+
+const char *simViolationNames[SIM_VIOLATIONS] = {
+	"clock half period", "start bit too soon", "no clock after RTS",
+	"slow host transfer", "missing ACK", "bad frame", "no response"
+};
+
+uint32_t simViolations[SIM_VIOLATIONS];
+uint32_t simHostInterrupted = 0;
+uint32_t simHostClockStart = 0;
+
+void (*simHostLogic)() = NULL;
+void (*simHostReceived)(uint8_t byte) = NULL;
+void (*simHostDone)(uint8_t acked) = NULL;
+
+static HostState state = HOST_IDLE;
+static uint64_t stateStart, holdUntil, lastEdge, lastRise, lastDevice;
+static int sendBit, rxBits = -1;
+static uint16_t sendFrame, rxFrame;
+static uint8_t clockLevel = 1, deviceClock, deviceData, errorSeen;
+
+static uint8_t oddParity(uint8_t byte) {
+	uint8_t parity = 1;
+
+	while(byte) {
+		parity ^= byte & 1;
+		byte >>= 1;
+	}
+
+	return parity;
+}
+
+static void hold(uint32_t us) {
+	rxBits = -1; // interrupts anything the firmware was sending
+	simExternalLow |= _BV(PS2_CLOCK_PIN);
+	state = HOST_HOLD;
+	stateStart = simNow;
+	holdUntil = simNow + us;
+}
+
+void simHostSend(uint8_t byte, uint32_t us) {
+	hold(us > HOST_RTS_MIN_US ? us : HOST_RTS_MIN_US);
+	sendFrame = byte | oddParity(byte) << 8 | 1 << 9;
+	sendBit = 0;
+}
+
+void simHostInhibit(uint32_t us) {
+	hold(us);
+	sendBit = -1;
+}
+
+uint8_t simHostBusy() {
+	return state != HOST_IDLE;
+}
+
+static void done(uint8_t acked) {
+	state = HOST_IDLE;
+	simExternalLow &= ~(_BV(PS2_CLOCK_PIN) | _BV(PS2_DATA_PIN));
+
+	if(simHostDone)
+		simHostDone(acked);
+}
+
+// Falling clock edge, data is valid or can be changed
+static void falling(uint8_t data) {
+	if(state == HOST_SEND) {
+		if(sendBit == 0 && simNow - stateStart > simHostClockStart)
+			simHostClockStart = simNow - stateStart;
+
+		if(sendBit < 10) { // data bits, parity and stop bit
+			if(sendFrame >> sendBit & 1)
+				simExternalLow &= ~_BV(PS2_DATA_PIN);
+			else
+				simExternalLow |= _BV(PS2_DATA_PIN);
+			sendBit++;
+		} else { // device acknowledges
+			if(data)
+				simViolations[SIM_V_NO_ACK]++;
+			if(simNow - stateStart > HOST_TRANSFER_US)
+				simViolations[SIM_V_SLOW_TRANSFER]++;
+			done(!data);
+		}
+
+		return;
+	}
+
+	if(state == HOST_HOLD) // our own inhibit, not a device clock
+		return;
+
+	if(rxBits < 0) {
+		if(!data) { // start bit
+			rxFrame = 0;
+			rxBits = 0;
+		}
+
+		return;
+	}
+
+	rxFrame |= data << rxBits;
+
+	if(++rxBits < 10)
+		return;
+
+	rxBits = -1;
+
+	if((rxFrame >> 9 & 1) != 1 ||
+			(rxFrame >> 8 & 1) != oddParity(rxFrame))
+		simViolations[SIM_V_BAD_FRAME]++;
+
+	if(simHostReceived)
+		simHostReceived(rxFrame);
+}
+
+static void hostStep() {
+	uint8_t pins = simPinB();
+	uint8_t clock = !!(pins & _BV(PS2_CLOCK_PIN));
+	uint8_t data = !!(pins & _BV(PS2_DATA_PIN));
+	uint8_t devClock = simDriveLow(PS2_CLOCK_PIN);
+	uint8_t devData = simDriveLow(PS2_DATA_PIN);
+
+	if(devClock != deviceClock) { // firmware clock timing
+		// Low times always, high times only between bits of a frame
+		if((!devClock || rxBits >= 0 ||
+				(state == HOST_SEND && sendBit > 0)) &&
+				(simNow - lastDevice < DEVICE_HALF_MIN_US ||
+				simNow - lastDevice > DEVICE_HALF_MAX_US))
+			simViolations[SIM_V_HALF_PERIOD]++;
+
+		lastDevice = simNow;
+		deviceClock = devClock;
+	}
+
+	if(devData && !deviceData && clock && state == HOST_IDLE &&
+			rxBits < 0 && simNow - lastRise < DEVICE_START_DELAY_US)
+		simViolations[SIM_V_START_TOO_SOON]++;
+	deviceData = devData;
+
+	if(ps2Error && !errorSeen)
+		simHostInterrupted++;
+	errorSeen = ps2Error;
+
+	if(rxBits >= 0 && simNow - lastEdge > FRAME_GAP_US)
+		rxBits = -1; // firmware gave up on frame
+
+	if(clock != clockLevel) {
+		lastEdge = simNow;
+		clockLevel = clock;
+
+		if(clock)
+			lastRise = simNow;
+		else
+			falling(data);
+	}
+
+	if(state == HOST_HOLD && simNow >= holdUntil) {
+		if(sendBit < 0) { // inhibit over
+			done(1);
+		} else { // request to send, start bit and release clock
+			simExternalLow |= _BV(PS2_DATA_PIN);
+			simExternalLow &= ~_BV(PS2_CLOCK_PIN);
+			state = HOST_SEND;
+			stateStart = simNow;
+		}
+	} else if(state == HOST_SEND && sendBit == 0 &&
+			simNow - stateStart > HOST_CLOCK_TIMEOUT_US) {
+		simViolations[SIM_V_NO_CLOCK]++; // give up
+		done(0);
+	}
+
+	if(state == HOST_IDLE && simHostLogic)
+		simHostLogic();
+}
+
+void simHostInit() {
+	simAttach(hostStep);
+}
@@ -0,0 +1,27 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: self-programming of the simulated
+ * flash, halting the CPU for the datasheet erase and write times.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_AVR_BOOT_H
+#define __SIM_AVR_BOOT_H
+
+#include <stdint.h>
+
+void simPageErase(uint16_t address);
+void simPageFill(uint16_t address, uint16_t word);
+void simPageWrite(uint16_t address);
+void simPageBufferClear();
+
+#define boot_page_erase(address) simPageErase(address)
+#define boot_page_fill(address, word) simPageFill(address, word)
+#define boot_page_write(address) simPageWrite(address)
+#define boot_page_buffer_clear() simPageBufferClear()
+#define boot_spm_busy_wait()
+
+#endif
@@ -0,0 +1,29 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: interrupt handlers are plain
+ * functions the simulator calls when enabled and pending.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_AVR_INTERRUPT_H
+#define __SIM_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector()
+#define EMPTY_INTERRUPT(vector) void vector() {}
+
+#define TIMER0_COMPA_vect simTimer0Vect
+#define TIMER1_COMPA_vect simTimer1Vect
+#define PCINT0_vect simPcint0Vect
+#define ADC_vect simAdcVect
+
+#include <stdint.h>
+
+extern uint8_t simInterrupts;
+
+#define sei() (simInterrupts = 1)
+#define cli() (simInterrupts = 0)
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: ATtiny45 registers as plain
+ * variables, PINB computed from firmware and simulated host drive.
+ * EEDR reads and writes EEPROM directly at EEAR, and reading EECR
+ * completes any EEPROM write.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_AVR_IO_H
+#define __SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t PORTB, DDRB, TIMSK, TIFR, TCCR0A, TCCR0B, OCR0A,
+	TCNT0, TCCR1, OCR1A, OCR1C, GIMSK, GIFR, PCMSK, MCUSR, GPIOR0,
+	ADMUX, ADCSRA, ADCSRB, SPMCSR;
+extern volatile uint16_t ADC, EEAR;
+
+// Pin levels depend on who is driving the bus right now
+uint8_t simPinB();
+#define PINB (simPinB())
+
+extern uint8_t simEeprom[];
+volatile uint8_t *simEecr();
+#define EEDR (simEeprom[EEAR])
+#define EECR (*simEecr())
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM01 1
+#define OCIE0A 4
+#define OCF0A 4
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define CS13 3
+#define CTC1 7
+#define OCIE1A 6
+
+#define MUX0 0
+#define MUX1 1
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+
+#define PCIE 5
+#define PCIF 5
+
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+
+#define SELFPRGEN 0
+#define CTPB 4
+
+#define SPM_PAGESIZE 64
+#define FLASHEND 0xFFF
+#define E2END 0xFF
+
+#endif
@@ -0,0 +1,29 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: program memory is just memory, except
+ * for numeric flash addresses, which read the simulated flash.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_AVR_PGMSPACE_H
+#define __SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+
+typedef const uint8_t prog_uint8_t;
+typedef const uint16_t prog_uint16_t;
+
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+
+extern uint8_t simFlash[];
+#define pgm_read_byte_near(address) (simFlash[(uint16_t)(address)])
+#define pgm_read_word_near(address) (simFlash[(uint16_t)(address)] | \
+	simFlash[(uint16_t)(address) + 1] << 8)
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: sleep_cpu() lets time pass until an
+ * interrupt, with timer 0 stopped in ADC noise reduction mode.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_AVR_SLEEP_H
+#define __SIM_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+
+#include <stdint.h>
+
+extern uint8_t simSleepMode;
+
+void simSleep();
+
+#define set_sleep_mode(mode) (simSleepMode = (mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() simSleep()
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: the firmware calls wdt_reset() in
+ * every wait loop, so that is where simulated time advances. Enabling
+ * the shortest timeout is how the firmware resets itself, that calls
+ * simReset (see sim.h).
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_AVR_WDT_H
+#define __SIM_AVR_WDT_H
+
+#include <stdint.h>
+
+#define WDTO_15MS 0
+#define WDTO_1S 6
+
+void simStep();
+void simWatchdog(uint8_t timeout);
+
+#define wdt_reset() simStep()
+#define wdt_enable(timeout) simWatchdog(timeout)
+#define wdt_disable()
+
+#endif
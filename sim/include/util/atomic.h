@@ -0,0 +1,19 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: interrupts only run when the
+ * firmware calls wdt_reset(), so every block is atomic already.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_UTIL_ATOMIC_H
+#define __SIM_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#define ATOMIC_BLOCK(type) for(int __atomic = 1; __atomic; __atomic = 0)
+
+#endif
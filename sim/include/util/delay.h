@@ -0,0 +1,20 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build shim for sim/sim.c: busy waits let simulated time pass.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_UTIL_DELAY_H
+#define __SIM_UTIL_DELAY_H
+
+#include <stdint.h>
+
+void simDelay(uint32_t us);
+
+#define _delay_us(us) simDelay((uint32_t)(us))
+#define _delay_ms(ms) simDelay((uint32_t)(ms) * 1000)
+
+#endif
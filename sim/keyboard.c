@@ -0,0 +1,189 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Simulated keyboard on the PS/2 host side pins (PS2_PROXY), see sim.h.
+ * Sends queued bytes with a 12.5 kHz clock, backs off and retries the
+ * byte when the firmware inhibits it, and clocks in and acknowledges
+ * whatever the firmware sends after a request to send.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <stddef.h>
+
+#include "../ps2.h"
+#include "sim.h"
+
+#ifdef PS2_PROXY
+
+#define KEYBOARD_HALF_US 40 // clock high and low time, 12.5 kHz
+#define KEYBOARD_SETUP_US 20 // data change to falling clock edge
+#define KEYBOARD_IDLE_US 50 // bus released this long before sending
+#define KEYBOARD_QUEUE 64
+
+typedef enum {
+	KEYBOARD_IDLE,
+	KEYBOARD_SEND, // clocking a byte out
+	KEYBOARD_RECEIVE // clocking a byte in after request to send
+} KeyboardState;
+
+uint32_t simKeyboardInterrupted = 0;
+
+void (*simKeyboardReceived)(uint8_t byte) = NULL;
+void (*simKeyboardSent)(uint8_t byte) = NULL;
+
+static KeyboardState state = KEYBOARD_IDLE;
+static uint64_t stateStart, busyAt; // last time the bus was not idle
+static uint8_t queue[KEYBOARD_QUEUE], head = 0, tail = 0, last = 0xAA;
+static uint16_t frame;
+
+static uint8_t oddParity(uint8_t byte) {
+	uint8_t parity = 1;
+
+	while(byte) {
+		parity ^= byte & 1;
+		byte >>= 1;
+	}
+
+	return parity;
+}
+
+static void drive(uint8_t pin, uint8_t low) {
+	if(low)
+		simExternalLow |= _BV(pin);
+	else
+		simExternalLow &= ~_BV(pin);
+}
+
+void simKeyboardSend(uint8_t byte) {
+	queue[tail] = byte;
+	tail = (tail + 1) % KEYBOARD_QUEUE;
+}
+
+// Put byte in front of the queue, for resends
+static void sendFirst(uint8_t byte) {
+	head = (head + KEYBOARD_QUEUE - 1) % KEYBOARD_QUEUE;
+	queue[head] = byte;
+}
+
+static void idle() {
+	drive(PS2_HOST_CLOCK_PIN, 0);
+	drive(PS2_HOST_DATA_PIN, 0);
+	state = KEYBOARD_IDLE;
+	busyAt = simNow;
+}
+
+// Device to host, bit n of frame is set up at n * 80 us and clocked
+// 20 us later. The host may inhibit us until the last falling edge.
+static void sendStep(uint8_t clock) {
+	uint32_t t = simNow - stateStart;
+	uint8_t bit = t / (2 * KEYBOARD_HALF_US);
+
+	switch(t % (2 * KEYBOARD_HALF_US)) {
+		case 0:
+			if(!clock) { // inhibited, try again later
+				simKeyboardInterrupted++;
+				idle();
+				return;
+			}
+
+			drive(PS2_HOST_DATA_PIN, !(frame >> bit & 1));
+			break;
+
+		case KEYBOARD_SETUP_US:
+			drive(PS2_HOST_CLOCK_PIN, 1);
+
+			if(bit == 10 && simKeyboardSent) // stop bit
+				simKeyboardSent(queue[head]);
+			break;
+
+		case KEYBOARD_SETUP_US + KEYBOARD_HALF_US:
+			drive(PS2_HOST_CLOCK_PIN, 0);
+
+			if(bit == 10) {
+				last = queue[head];
+				head = (head + 1) % KEYBOARD_QUEUE;
+				idle();
+			}
+			break;
+	}
+}
+
+// Host to device, data is read on the rising edges of clocks 1-10 and
+// acknowledged by holding data low over the 11th clock
+static void receiveStep(uint8_t data) {
+	uint32_t t = simNow - stateStart;
+	uint8_t bit = t / (2 * KEYBOARD_HALF_US);
+	uint8_t byte;
+
+	if(t % (2 * KEYBOARD_HALF_US) == 0) {
+		drive(PS2_HOST_CLOCK_PIN, 1);
+		return;
+	}
+
+	if(t % (2 * KEYBOARD_HALF_US) != KEYBOARD_HALF_US)
+		return;
+
+	drive(PS2_HOST_CLOCK_PIN, 0);
+
+	if(bit < 10) {
+		frame |= data << bit;
+
+		if(bit == 9) // stop bit read, acknowledge
+			drive(PS2_HOST_DATA_PIN, 1);
+
+		return;
+	}
+
+	idle();
+	byte = frame;
+
+	if(!(frame >> 9 & 1) || (frame >> 8 & 1) != oddParity(byte))
+		sendFirst(PS2_CMD_Resend);
+	else if(byte == PS2_CMD_Resend)
+		sendFirst(last);
+	else if(simKeyboardReceived)
+		simKeyboardReceived(byte);
+}
+
+static void keyboardStep() {
+	uint8_t pins = simPinB();
+	uint8_t clock = !!(pins & _BV(PS2_HOST_CLOCK_PIN));
+	uint8_t data = !!(pins & _BV(PS2_HOST_DATA_PIN));
+
+	switch(state) {
+		case KEYBOARD_IDLE:
+			if(!clock) { // inhibited
+				busyAt = simNow;
+			} else if(simNow - busyAt < KEYBOARD_IDLE_US) {
+				// let the bus settle
+			} else if(!data) { // request to send
+				state = KEYBOARD_RECEIVE;
+				stateStart = simNow;
+				frame = 0;
+				receiveStep(data);
+			} else if(head != tail) {
+				state = KEYBOARD_SEND;
+				stateStart = simNow;
+				frame = queue[head] << 1 | oddParity(queue[head]) << 9 |
+					1 << 10;
+				sendStep(clock);
+			}
+			break;
+
+		case KEYBOARD_SEND:
+			sendStep(clock);
+			break;
+
+		case KEYBOARD_RECEIVE:
+			receiveStep(data);
+			break;
+	}
+}
+
+void simKeyboardInit() {
+	simAttach(keyboardStep);
+}
+
+#endif
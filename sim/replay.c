@@ -0,0 +1,688 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Logic analyzer trace replay. Decodes recorded clock/data captures of
+ * a real host talking to a real keyboard (sigrok CSV or VCD), then
+ * replays the host side against the firmware running in simulation and
+ * reports handshake completion time, retransmits and protocol
+ * violations for each capture.
+ *
+ * The firmware runs in the simulator described in sim.h, with the
+ * simulated host in sim/host.c on the other end of the bus.
+ *
+ * The replayed host is reactive: each host byte (or inhibit) waits for
+ * as many keyboard bytes as it did in the capture, then for the same
+ * think time the real host took, so a slower or faster firmware shifts
+ * the rest of the handshake like it would on real hardware.
+ *
+ * Built with PS2_PROXY (MAIN = proxy ps2host) the firmware is the proxy
+ * and the simulated keyboard in sim/keyboard.c sits on its host side
+ * pins. The keyboard answers each forwarded host byte with the keyboard
+ * bytes that followed it in the capture, and the time from each of its
+ * stop bits to the remapped byte reaching the host is reported as proxy
+ * latency.
+ *
+ * Usage: replay [-r samplerate] [-t] [-c col] [-d col] [-C name]
+ *               [-D name] [-o offset_ms] [-v] capture...
+ *
+ *   -r   CSV sample rate in Hz, if the file does not say it
+ *   -t   CSV first column is time in seconds instead of sample index
+ *   -c   CSV column of clock (default 0, not counting time column)
+ *   -d   CSV column of data (default 1)
+ *   -C   VCD signal name of clock (default name containing "clk")
+ *   -D   VCD signal name of data (default name containing "dat")
+ *   -o   firmware time when replay starts (default 3100 ms, after the
+ *        power-up delay in main.c)
+ *   -v   print every replayed byte with its time
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#define _GNU_SOURCE // strcasestr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../ps2.h"
+#include "sim.h"
+
+#undef main // firmware main() is renamed to firmwareMain
+
+// Host side timing from the PS/2 specification, microseconds
+#define HOST_LOW_US 60 // clock low longer than this is the host
+#define HOST_CLOCK_TIMEOUT_US 15000 // device must start clocking
+#define HOST_RESPONSE_TIMEOUT_US 20000 // device must respond
+#define FRAME_GAP_US 1000 // longer pause between edges ends a frame
+#define TAIL_US 100000 // run after the last event
+
+// Recorded line transitions, times in nanoseconds
+typedef struct {
+	uint64_t time;
+	uint8_t clock, data;
+} Sample;
+
+typedef enum {
+	EVENT_HOST_BYTE,
+	EVENT_INHIBIT
+} EventType;
+
+// Host activity decoded from capture
+typedef struct {
+	EventType type;
+	uint8_t byte;
+	uint32_t hold; // clock hold (request to send or inhibit), us
+	uint32_t wait; // keyboard bytes since the previous host byte
+	uint32_t gap; // host think time after those, us
+} Event;
+
+typedef struct {
+	uint32_t hostBytes, inhibits, deviceBytes;
+	uint32_t hostResends, deviceResends, interrupted;
+	uint32_t violations[SIM_VIOLATIONS];
+	uint32_t mismatches;
+	uint32_t clockStart; // longest request to send to first clock, us
+	uint64_t first, last; // first host activity, last device byte end
+} Stats;
+
+// Capture being replayed
+static Sample *samples;
+static int sampleCount;
+static Event *events;
+static int eventCount;
+static uint8_t *expected; // keyboard bytes in capture
+static int expectedCount;
+static Stats original, firmware;
+
+// Command line options
+static double sampleRate = 0;
+static int timeColumn = 0, clockColumn = 0, dataColumn = 1;
+static const char *clockName = NULL, *dataName = NULL;
+static uint64_t offset = 3100000;
+static int verbose = 0;
+
+static void addSample(int *size, uint64_t time, int clock, int data) {
+	if(sampleCount && samples[sampleCount - 1].clock == clock &&
+			samples[sampleCount - 1].data == data)
+		return; // only transitions matter
+
+	if(sampleCount == *size) {
+		*size = *size ? *size * 2 : 1024;
+		samples = realloc(samples, *size * sizeof(Sample));
+	}
+
+	samples[sampleCount].time = time;
+	samples[sampleCount].clock = clock;
+	samples[sampleCount].data = data;
+	sampleCount++;
+}
+
+// Sample rate from sigrok comment like "; Samplerate: 1 MHz"
+static void parseRate(const char *line) {
+	const char *p = strcasestr(line, "samplerate");
+	char *end;
+	double rate;
+
+	if(!p || sampleRate)
+		return;
+
+	while(*p && !isdigit((unsigned char)*p))
+		p++;
+
+	rate = strtod(p, &end);
+
+	while(*end == ' ')
+		end++;
+
+	if(*end == 'k' || *end == 'K')
+		rate *= 1e3;
+	else if(*end == 'M')
+		rate *= 1e6;
+	else if(*end == 'G')
+		rate *= 1e9;
+
+	sampleRate = rate;
+}
+
+static int loadCSV(FILE *f) {
+	char line[1024], *p, *end;
+	int size = 0, column, clock = -1, data = -1;
+	uint64_t index = 0, time;
+	double value, seconds = 0;
+
+	while(fgets(line, sizeof(line), f)) {
+		if(!isdigit((unsigned char)line[0]) && line[0] != '-' &&
+				line[0] != '.') {
+			parseRate(line); // comment or header
+			continue;
+		}
+
+		for(p = line, column = -timeColumn; *p; column++) {
+			value = strtod(p, &end);
+
+			if(end == p)
+				break;
+
+			if(column < 0)
+				seconds = value;
+			if(column == clockColumn)
+				clock = value != 0;
+			if(column == dataColumn)
+				data = value != 0;
+
+			for(p = end; *p == ',' || *p == ' ' || *p == '\t'; p++)
+				;
+		}
+
+		if(clock < 0 || data < 0) {
+			fprintf(stderr, "CSV line without clock and data columns\n");
+			return 0;
+		}
+
+		if(timeColumn)
+			time = seconds * 1e9;
+		else if(sampleRate)
+			time = index * 1e9 / sampleRate;
+		else {
+			fprintf(stderr, "CSV sample rate unknown, use -r\n");
+			return 0;
+		}
+
+		addSample(&size, time, clock, data);
+		index++;
+	}
+
+	return sampleCount > 0;
+}
+
+static int loadVCD(FILE *f) {
+	char token[256], id[64], name[64], clockId[64] = "", dataId[64] = "";
+	int size = 0, clock = 1, data = 1, var = 0;
+	double scale = 1; // nanoseconds per time unit
+	uint64_t time = 0;
+
+	while(fscanf(f, "%255s", token) == 1) {
+		if(!strcmp(token, "$timescale")) {
+			double amount = 1;
+			char unit[16] = "";
+
+			if(fscanf(f, "%255s", token) != 1)
+				return 0;
+			if(sscanf(token, "%lf%15s", &amount, unit) < 2 &&
+					fscanf(f, "%15s", unit) != 1)
+				return 0;
+
+			scale = amount * (!strncmp(unit, "ps", 2) ? 1e-3 :
+				!strncmp(unit, "ns", 2) ? 1 :
+				!strncmp(unit, "us", 2) ? 1e3 :
+				!strncmp(unit, "ms", 2) ? 1e6 : 1e9);
+		} else if(!strcmp(token, "$var")) {
+			if(fscanf(f, "%*s %*s %63s %63s", id, name) != 2)
+				return 0;
+
+			if(clockName ? !strcmp(name, clockName) :
+					!*clockId && (strcasestr(name, "clk") ||
+					strcasestr(name, "clock") || var == 0))
+				strcpy(clockId, id);
+			else if(dataName ? !strcmp(name, dataName) :
+					!*dataId && (strcasestr(name, "dat") || var == 1))
+				strcpy(dataId, id);
+
+			var++;
+		} else if(token[0] == '#') {
+			if(time || sampleCount)
+				addSample(&size, time, clock, data);
+			time = strtoull(token + 1, NULL, 10) * scale;
+		} else if(token[0] == '0' || token[0] == '1') {
+			if(!strcmp(token + 1, clockId))
+				clock = token[0] == '1';
+			else if(!strcmp(token + 1, dataId))
+				data = token[0] == '1';
+		}
+	}
+
+	if(!*clockId || !*dataId) {
+		fprintf(stderr, "VCD clock or data signal not found\n");
+		return 0;
+	}
+
+	addSample(&size, time, clock, data);
+
+	return sampleCount > 0;
+}
+
+static void addEvent(int *size, EventType type, uint8_t byte,
+		uint32_t hold, uint32_t wait, uint32_t gap) {
+	if(eventCount == *size) {
+		*size = *size ? *size * 2 : 64;
+		events = realloc(events, *size * sizeof(Event));
+	}
+
+	events[eventCount].type = type;
+	events[eventCount].byte = byte;
+	events[eventCount].hold = hold;
+	events[eventCount].wait = wait;
+	events[eventCount].gap = gap;
+	eventCount++;
+}
+
+static uint8_t oddParity(uint8_t byte) {
+	uint8_t parity = 1;
+
+	while(byte) {
+		parity ^= byte & 1;
+		byte >>= 1;
+	}
+
+	return parity;
+}
+
+// Keyboard byte seen in capture
+static void decodeDeviceByte(uint16_t rx, uint64_t t, int *expectedSize) {
+	if((rx >> 9 & 1) != 1 || (rx >> 8 & 1) != oddParity(rx))
+		original.violations[SIM_V_BAD_FRAME]++;
+
+	if((rx & 0xFF) == PS2_CMD_Resend)
+		original.deviceResends++;
+
+	if(expectedCount == *expectedSize) {
+		*expectedSize = *expectedSize ? *expectedSize * 2 : 64;
+		expected = realloc(expected, *expectedSize);
+	}
+
+	expected[expectedCount++] = rx;
+	original.deviceBytes++;
+	original.last = t;
+}
+
+// Decode capture into host events and original keyboard statistics.
+// Keyboard bytes before any host activity (power-up BAT) are skipped,
+// the firmware does not send them.
+static void decode() {
+	int i, size = 0, expectedSize = 0, rxBits = -1, txBits = -1;
+	uint16_t rx = 0, tx = 0;
+	uint64_t lowStart = 0, holdStart = 0, hold = 0, lastEdge = 0;
+	uint64_t release = 0;
+	uint64_t ready = 0, t;
+	uint32_t wait = 0;
+	uint8_t clock = 1, data;
+
+	for(i = 0; i < sampleCount; i++) {
+		t = samples[i].time / 1000; // microseconds
+		data = samples[i].data;
+
+		if(rxBits >= 0 && t - lastEdge > FRAME_GAP_US)
+			rxBits = -1; // keyboard gave up on frame
+		if(txBits >= 0 && t - lastEdge > HOST_CLOCK_TIMEOUT_US)
+			txBits = -1; // host gave up on frame
+
+		if(clock && !samples[i].clock) { // falling edge
+			lowStart = lastEdge = t;
+
+			if(txBits == 0 && t - release > original.clockStart)
+				original.clockStart = t - release;
+
+			if(txBits == 10) { // keyboard acknowledges
+				if(data)
+					original.violations[SIM_V_NO_ACK]++;
+				if((tx & 0xFF) == PS2_CMD_Resend)
+					original.hostResends++;
+
+				addEvent(&size, EVENT_HOST_BYTE, tx, hold, wait,
+					eventCount ? holdStart - ready : 0);
+				original.hostBytes++;
+				wait = 0;
+				ready = t;
+				txBits = -1;
+			} else if(rxBits >= 0) { // keyboard to host bit
+				rx |= data << rxBits;
+
+				if(++rxBits == 10) {
+					decodeDeviceByte(rx, t, &expectedSize);
+					ready = t;
+					wait++;
+					rxBits = -1;
+				}
+			} else if(txBits < 0 && !data &&
+					(original.hostBytes || original.inhibits)) {
+				rx = 0; // start bit
+				rxBits = 0;
+			}
+		} else if(!clock && samples[i].clock) { // rising edge
+			lastEdge = t;
+
+			if(t - lowStart > HOST_LOW_US) { // host held clock
+				if(rxBits > 0) // keyboard was sending
+					original.interrupted++;
+
+				rxBits = -1;
+				holdStart = lowStart;
+				hold = t - lowStart;
+
+				if(!original.hostBytes && !original.inhibits)
+					original.first = lowStart;
+
+				if(!data) { // request to send
+					tx = 0;
+					txBits = 0;
+					release = t;
+				} else {
+					addEvent(&size, EVENT_INHIBIT, 0, hold, wait,
+						eventCount ? holdStart - ready : 0);
+					original.inhibits++;
+					ready = t; // responses still count for the last byte
+				}
+			} else if(txBits >= 0 && txBits < 10) { // host to keyboard
+				tx |= data << txBits++;
+			}
+		}
+
+		clock = samples[i].clock;
+	}
+}
+
+// Replay state, times in microseconds
+static jmp_buf simDone;
+static int nextEvent, received, resend = -1;
+static uint64_t readyAt;
+static uint8_t lastSent, waiting;
+static EventType current;
+static int group, groupSize; // capture bytes answering last host byte
+
+#ifdef PS2_PROXY
+#define PROXY_FIFO 64
+
+uint8_t remap(uint8_t code); // proxy.c
+
+// Keyboard bytes on their way through the proxy
+static struct {
+	uint8_t byte;
+	uint64_t time;
+} proxyFifo[PROXY_FIFO];
+static int proxyHead, proxyTail;
+static uint64_t proxyTotal;
+static uint32_t proxyMax, proxyBytes;
+
+#define EXPECTED(i) remap(expected[i])
+
+// Host byte forwarded by the proxy, answer like the captured keyboard
+static void keyboardReceived(uint8_t byte) {
+	int i;
+
+	for(i = group; i < group + groupSize; i++)
+		simKeyboardSend(expected[i]);
+
+	(void)byte;
+}
+
+// Stop bit of a keyboard byte, the proxy has it now
+static void keyboardSent(uint8_t byte) {
+	proxyFifo[proxyTail].byte = remap(byte);
+	proxyFifo[proxyTail].time = simNow;
+	proxyTail = (proxyTail + 1) % PROXY_FIFO;
+}
+
+// Byte reached the host, match it with the oldest keyboard byte that
+// has the same value. Bytes the proxy dropped are skipped that way.
+static void proxyLatency(uint8_t byte) {
+	uint32_t latency;
+	int i;
+
+	for(i = proxyHead; i != proxyTail; i = (i + 1) % PROXY_FIFO) {
+		if(proxyFifo[i].byte != byte)
+			continue;
+
+		latency = simNow - proxyFifo[i].time;
+		proxyTotal += latency;
+		proxyBytes++;
+		if(latency > proxyMax)
+			proxyMax = latency;
+
+		proxyHead = (i + 1) % PROXY_FIFO;
+		break;
+	}
+}
+#else
+#define EXPECTED(i) expected[i]
+#endif
+
+static void startEvent(EventType type, uint8_t byte, uint32_t hold) {
+	if(verbose) {
+		if(type == EVENT_HOST_BYTE)
+			printf("%10.3f ms host     %02X\n", (simNow - offset) / 1000.0,
+				byte);
+		else
+			printf("%10.3f ms host     inhibit %u us\n",
+				(simNow - offset) / 1000.0, hold);
+	}
+
+	if(type == EVENT_HOST_BYTE) {
+		simHostSend(byte, hold);
+		lastSent = byte;
+		firmware.hostBytes++;
+		if(byte == PS2_CMD_Resend)
+			firmware.hostResends++;
+	} else {
+		simHostInhibit(hold);
+		firmware.inhibits++;
+	}
+
+	if(!firmware.first)
+		firmware.first = simNow;
+
+	current = type;
+}
+
+static void eventDone(uint8_t acked) {
+	if(current == EVENT_HOST_BYTE) // inhibits do not start a new response
+		received = 0;
+
+	waiting = 1;
+	readyAt = simNow;
+	(void)acked; // violation already counted, the host moves on
+}
+
+// Byte from the firmware
+static void deviceByte(uint8_t byte) {
+	uint8_t mismatch = received >= groupSize ||
+		EXPECTED(group + received) != byte;
+
+	if(mismatch)
+		firmware.mismatches++;
+
+#ifdef PS2_PROXY
+	proxyLatency(byte);
+#endif
+
+	if(verbose)
+		printf("%10.3f ms keyboard %02X\n", (simNow - offset) / 1000.0,
+			byte);
+
+	firmware.deviceBytes++;
+	firmware.last = simNow;
+	received++;
+
+	if(byte == PS2_CMD_Resend) {
+		firmware.deviceResends++;
+
+		// Send last byte again, unless the capture did that already
+		if(mismatch)
+			resend = lastSent;
+	}
+}
+
+// Decide when to start the next event
+static void hostLogic() {
+	Event *e;
+	int i;
+
+	if(simNow < offset)
+		return;
+
+	if(resend >= 0) {
+		startEvent(EVENT_HOST_BYTE, resend, 0);
+		resend = -1;
+		return;
+	}
+
+	if(nextEvent == eventCount) {
+		if(simNow - (firmware.last > readyAt ? firmware.last : readyAt) >
+				TAIL_US)
+			longjmp(simDone, 1);
+		return;
+	}
+
+	e = &events[nextEvent];
+
+	if(waiting && received < (int)e->wait) {
+		if(simNow - readyAt <= HOST_RESPONSE_TIMEOUT_US)
+			return;
+
+		simViolations[SIM_V_NO_RESPONSE]++;
+	}
+
+	if(waiting) { // responses are in, think time starts now
+		waiting = 0;
+		if(received && firmware.last > readyAt)
+			readyAt = firmware.last;
+	}
+
+	if(simNow < readyAt + e->gap)
+		return;
+
+	if(e->type == EVENT_HOST_BYTE) { // expected answer follows e->wait
+		group += groupSize;
+		groupSize = expectedCount - group;
+
+		for(i = nextEvent + 1; i < eventCount; i++)
+			if(events[i].type == EVENT_HOST_BYTE) {
+				groupSize = events[i].wait;
+				break;
+			}
+	}
+
+	startEvent(e->type, e->byte, e->hold);
+	nextEvent++;
+}
+
+static void printStats(const char *name, Stats *s) {
+	int i;
+
+	printf("  %-9s handshake %8.2f ms, %u host bytes, %u inhibits, "
+		"%u keyboard bytes\n", name,
+		s->last > s->first ? (s->last - s->first) / 1000.0 : 0.0,
+		s->hostBytes, s->inhibits, s->deviceBytes);
+	printf("            retransmits: %u host resend requests, "
+		"%u keyboard resend requests, %u interrupted sends\n",
+		s->hostResends, s->deviceResends, s->interrupted);
+	printf("            longest request to send to first clock %u us\n",
+		s->clockStart);
+	printf("            violations:");
+
+	for(i = 0; i < SIM_VIOLATIONS; i++)
+		printf("%s %s %u", i ? "," : "", simViolationNames[i],
+			s->violations[i]);
+
+	printf("\n");
+}
+
+static int replay(const char *path) {
+	FILE *f = fopen(path, "r");
+	const char *ext = strrchr(path, '.');
+	int ok;
+
+	if(!f) {
+		perror(path);
+		return 1;
+	}
+
+	ok = ext && !strcasecmp(ext, ".vcd") ? loadVCD(f) : loadCSV(f);
+	fclose(f);
+
+	if(!ok) {
+		fprintf(stderr, "%s: no samples\n", path);
+		return 1;
+	}
+
+	decode();
+	printf("%s\n", path);
+
+	readyAt = offset;
+	simHostLogic = hostLogic;
+	simHostReceived = deviceByte;
+	simHostDone = eventDone;
+	simHostInit();
+#ifdef PS2_PROXY
+	simKeyboardReceived = keyboardReceived;
+	simKeyboardSent = keyboardSent;
+	simKeyboardInit();
+#endif
+
+	if(!setjmp(simDone))
+		firmwareMain(); // returns through longjmp when done
+
+	memcpy(firmware.violations, simViolations, sizeof(simViolations));
+	firmware.interrupted = simHostInterrupted;
+	firmware.clockStart = simHostClockStart;
+
+	printStats("original", &original);
+	printStats("firmware", &firmware);
+	printf("            timebase error %+.0f ppm\n",
+		((millisCount * 1000.0 + millisTicks * TIMER0_TICK_US) - simNow) *
+		1e6 / simNow);
+#ifdef PS2_PROXY
+	printf("            proxy latency %.1f us average, %u us max over %u "
+		"bytes, %u keyboard sends inhibited\n",
+		proxyBytes ? (double)proxyTotal / proxyBytes : 0.0, proxyMax,
+		proxyBytes, simKeyboardInterrupted);
+#endif
+	printf("            %u keyboard bytes differ from capture\n",
+		firmware.mismatches);
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int opt, status, result = 0;
+
+	while((opt = getopt(argc, argv, "r:tc:d:C:D:o:v")) != -1) {
+		switch(opt) {
+			case 'r': sampleRate = atof(optarg); break;
+			case 't': timeColumn = 1; break;
+			case 'c': clockColumn = atoi(optarg); break;
+			case 'd': dataColumn = atoi(optarg); break;
+			case 'C': clockName = optarg; break;
+			case 'D': dataName = optarg; break;
+			case 'o': offset = atof(optarg) * 1000; break;
+			case 'v': verbose = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-r rate] [-t] [-c col] "
+					"[-d col] [-C name] [-D name] [-o offset_ms] [-v] "
+					"capture...\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if(optind == argc) {
+		fprintf(stderr, "no captures given\n");
+		return 2;
+	}
+
+	// Each capture gets a freshly started firmware
+	for(; optind < argc; optind++) {
+		fflush(stdout);
+
+		if(!fork())
+			exit(replay(argv[optind]));
+
+		wait(&status);
+		result |= !WIFEXITED(status) || WEXITSTATUS(status);
+	}
+
+	return result;
+}
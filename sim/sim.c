@@ -0,0 +1,208 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build simulator core, see sim.h.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <avr/boot.h>
+
+#include "../timer.h"
+#include "../adc.h"
+#include "sim.h"
+
+#define SIM_DEVICES 4
+#define SIM_SPM_US 4500 // page erase and write, CPU halted
+
+// Registers declared in sim/include/avr/io.h
+volatile uint8_t PORTB, DDRB, TIMSK, TIFR, TCCR0A, TCCR0B, OCR0A,
+	TCNT0, TCCR1, OCR1A, OCR1C, GIMSK, GIFR, PCMSK, MCUSR, GPIOR0,
+	ADMUX, ADCSRA, ADCSRB, SPMCSR;
+volatile uint16_t ADC, EEAR;
+
+// Erased flash and EEPROM read all ones
+uint8_t simFlash[FLASHEND + 1] = { [0 ... FLASHEND] = 0xFF };
+uint8_t simEeprom[E2END + 1] = { [0 ... E2END] = 0xFF };
+
+uint64_t simNow = 0;
+uint8_t simInterrupts = 0;
+uint8_t simExternalLow = 0;
+uint8_t simSleepMode = SLEEP_MODE_IDLE;
+uint16_t simAdcValue = 0;
+void (*simReset)() = NULL;
+
+static void (*devices[SIM_DEVICES])();
+static uint8_t deviceCount = 0;
+
+static uint32_t timer0Micros = 0; // since last compare match
+static uint32_t adcMicros = 0; // into current conversion
+static uint8_t lastPins = 0xFF, pinChange = 0, adcDone = 0;
+static uint8_t timerStopped = 0, woken = 0;
+static uint8_t eecr = 0;
+static uint16_t pageBuffer[SPM_PAGESIZE / 2] = {
+	[0 ... SPM_PAGESIZE / 2 - 1] = 0xFFFF
+};
+
+// Handlers the firmware may not have, depending on build flavor
+void __attribute__((weak)) simPcint0Vect() {}
+void __attribute__((weak)) simAdcVect() {}
+
+void simTimer0Vect();
+
+uint8_t simPinB() {
+	uint8_t pins = ~simExternalLow, pin;
+
+	for(pin = 0; pin < 8; pin++)
+		if(simDriveLow(pin))
+			pins &= ~_BV(pin);
+
+	return pins;
+}
+
+void simAttach(void (*step)()) {
+	devices[deviceCount++] = step;
+}
+
+// Call handlers of pending interrupts, in vector table order
+static void simInterrupt() {
+	if(!simInterrupts)
+		return;
+
+	if(pinChange && (GIMSK & _BV(PCIE))) {
+		pinChange = 0;
+		woken = 1;
+		simPcint0Vect();
+	}
+
+	if(adcDone && (ADCSRA & _BV(ADIE))) {
+		adcDone = 0;
+		woken = 1;
+		simAdcVect();
+	}
+
+	if((TIFR & _BV(OCF0A)) && (TIMSK & _BV(OCIE0A))) {
+		TIFR &= ~_BV(OCF0A);
+		woken = 1;
+		simTimer0Vect();
+	}
+}
+
+void simStep() {
+	uint8_t i, pins;
+
+	simNow++;
+
+	if(TCCR0B && !timerStopped) { // timer 0 running
+		if(++timer0Micros == TIMER0_TICK_US) {
+			timer0Micros = 0;
+			TIFR |= _BV(OCF0A);
+		}
+
+		TCNT0 = timer0Micros * (F_CPU / 1000000L) / TIMER0_PRESCALE;
+	}
+
+	// Like GIFR, ADIF is cleared by the firmware right before ADIE is
+	// set, so only conversions completing with ADIE set count
+	if((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADSC)) &&
+			++adcMicros >= ADC_CONVERSION_US) {
+		adcMicros = 0;
+		ADC = simAdcValue;
+		adcDone = !!(ADCSRA & _BV(ADIE));
+
+		if(!(ADCSRA & _BV(ADATE)))
+			ADCSRA &= ~_BV(ADSC);
+	}
+
+	for(i = 0; i < deviceCount; i++)
+		devices[i]();
+
+	// Only edges while the interrupt is enabled count, the firmware
+	// clears GIFR before enabling it anyway
+	pins = simPinB();
+
+	if((pins ^ lastPins) & PCMSK & 0x3F && (GIMSK & _BV(PCIE)))
+		pinChange = 1;
+
+	lastPins = pins;
+
+	simInterrupt();
+}
+
+// Until an interrupt handler has run. In ADC noise reduction mode timer
+// 0 stops and a conversion starts if the ADC is idle.
+void simSleep() {
+	if(simSleepMode == SLEEP_MODE_ADC) {
+		timerStopped = 1;
+
+		if(!(ADCSRA & _BV(ADSC))) {
+			ADCSRA |= _BV(ADSC);
+			adcMicros = 0;
+		}
+	}
+
+	for(woken = 0; !woken; )
+		simStep();
+
+	timerStopped = 0;
+}
+
+void simDelay(uint32_t us) {
+	while(us--)
+		simStep();
+}
+
+// EEPROM writes are done as soon as the value is in EEDR
+volatile uint8_t *simEecr() {
+	eecr &= ~_BV(EEPE);
+
+	return &eecr;
+}
+
+void simWatchdog(uint8_t timeout) {
+	if(timeout == WDTO_15MS && simReset)
+		simReset();
+}
+
+void simPageErase(uint16_t address) {
+	uint8_t i;
+
+	address -= address % SPM_PAGESIZE;
+
+	for(i = 0; i < SPM_PAGESIZE; i++)
+		simFlash[address + i] = 0xFF;
+
+	simDelay(SIM_SPM_US);
+}
+
+void simPageFill(uint16_t address, uint16_t word) {
+	pageBuffer[address % SPM_PAGESIZE / 2] = word;
+}
+
+// Like flash cells, only clears bits, then clears the page buffer
+void simPageWrite(uint16_t address) {
+	uint8_t i;
+
+	address -= address % SPM_PAGESIZE;
+
+	for(i = 0; i < SPM_PAGESIZE / 2; i++) {
+		simFlash[address + 2 * i] &= pageBuffer[i];
+		simFlash[address + 2 * i + 1] &= pageBuffer[i] >> 8;
+	}
+
+	simPageBufferClear();
+	simDelay(SIM_SPM_US);
+}
+
+void simPageBufferClear() {
+	uint8_t i;
+
+	for(i = 0; i < SPM_PAGESIZE / 2; i++)
+		pageBuffer[i] = 0xFFFF;
+}
@@ -0,0 +1,118 @@
+/**
+ * PS/2 keyboard implementation and knock sensor.
+ * Host build simulator. The firmware sources are compiled unmodified
+ * for the host with the shims in sim/include, and run on simulated
+ * time: one microsecond passes on every wdt_reset() and for each
+ * microsecond of _delay_us(), which covers all waiting the firmware
+ * does. Interrupt handlers are called between those steps when enabled
+ * and pending. There is no cycle model, code itself takes no time.
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+// Microseconds since simulated power-up
+extern uint64_t simNow;
+
+// Global interrupt enable, see sei() and cli() in avr/interrupt.h
+extern uint8_t simInterrupts;
+
+// Port B pins pulled low from outside, the bus is a wired-AND of these
+// and the pins the firmware drives low
+extern uint8_t simExternalLow;
+
+// Value of every ADC conversion (knock sensor level)
+extern uint16_t simAdcValue;
+
+// Flash and EEPROM contents, written by the bootloader (PS2_UPDATE)
+extern uint8_t simFlash[FLASHEND + 1];
+extern uint8_t simEeprom[E2END + 1];
+
+// Called when the firmware resets itself through the watchdog, must
+// not return (longjmp out)
+extern void (*simReset)();
+
+// Pin held low by the firmware
+#define simDriveLow(pin) ((DDRB & _BV(pin)) && !(PORTB & _BV(pin)))
+
+// Add a device model called every simulated microsecond
+void simAttach(void (*step)());
+
+// Let one microsecond pass
+void simStep();
+
+// Let some microseconds pass
+void simDelay(uint32_t us);
+
+// Firmware entry point, main() renamed by the Makefile
+int firmwareMain(void);
+
+// Violations of the PS/2 device timing, found by the host engine
+typedef enum {
+	SIM_V_HALF_PERIOD, // clock high or low time outside 30-50 us
+	SIM_V_START_TOO_SOON, // start bit within 50 us of clock release
+	SIM_V_NO_CLOCK, // no clock within 15 ms of request to send
+	SIM_V_SLOW_TRANSFER, // host to device byte took over 2 ms
+	SIM_V_NO_ACK, // data not held low for the last clock
+	SIM_V_BAD_FRAME, // parity or stop bit wrong
+	SIM_V_NO_RESPONSE, // expected answer missing, counted by caller
+	SIM_VIOLATIONS
+} SimViolation;
+
+extern const char *simViolationNames[SIM_VIOLATIONS];
+extern uint32_t simViolations[SIM_VIOLATIONS];
+
+// Host side PS/2 engine on the device pins. Start it with
+// simHostInit(), then drive it from simHostLogic.
+void simHostInit();
+
+// Request to send, holding clock for hold us (at least 100 us)
+void simHostSend(uint8_t byte, uint32_t hold);
+
+// Hold clock low for hold us
+void simHostInhibit(uint32_t hold);
+
+// Request to send or inhibit in progress
+uint8_t simHostBusy();
+
+// Firmware sends aborted by our inhibits and requests (ps2Error)
+extern uint32_t simHostInterrupted;
+
+// Longest time from releasing clock in request to send to the first
+// falling clock edge from the firmware, including any wake-up
+extern uint32_t simHostClockStart;
+
+// Called every microsecond when not busy, to decide what to do next
+extern void (*simHostLogic)();
+
+// Called for every byte the firmware sends, bad frames included
+extern void (*simHostReceived)(uint8_t byte);
+
+// Called when a send or inhibit is over, acked is 0 if the firmware
+// did not clock the byte in or did not acknowledge it
+extern void (*simHostDone)(uint8_t acked);
+
+// Keyboard on the PS/2 host side pins (PS2_PROXY only), start it with
+// simKeyboardInit(). Resend requests (0xFE) are answered internally.
+void simKeyboardInit();
+
+// Queue byte to send to the firmware
+void simKeyboardSend(uint8_t byte);
+
+// Keyboard sends aborted by firmware inhibits, retried afterwards
+extern uint32_t simKeyboardInterrupted;
+
+// Called for every byte the firmware sends to the keyboard
+extern void (*simKeyboardReceived)(uint8_t byte);
+
+// Called on the stop bit of every byte the keyboard sends
+extern void (*simKeyboardSent)(uint8_t byte);
+
+#endif
@@ -0,0 +1,408 @@
+/**
+ * Firmware updater for the simulated device, see boot.h and sim.h.
+ * Loads an Intel HEX image and runs the update protocol with the
+ * simulated host: 0xE2 to the application, then every non-blank
+ * application page, then 0xE4 with the image CRC. Before the real
+ * update it checks that the bootloader refuses 0xE4 before page 0 is
+ * written and a page with a bad CRC, and writes the last page with
+ * zeros so the real update has to erase it again. After the reset the
+ * simulated flash and EEPROM must hold the image, the bootloader reset
+ * vector and the application entry.
+ *
+ * The firmware runs in the simulator described in sim.h, built with
+ * PS2_UPDATE. Flash erase and write halt it for 4.5 ms each like on
+ * the real device, code itself takes no time.
+ *
+ * Usage: update [-v] image.hex
+ *
+ *   -v   print every step with its time
+ *
+ * Copyright (C) Joonas Pihlajamaa 2013.
+ * Licensed under GNU GPL v3, see LICENSE for details.
+ *
+ * See README.md or http://codeandlife/?p=1488 for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+#include "../ps2.h"
+#include "../boot.h"
+#include "sim.h"
+
+#undef main // firmware main() is renamed to firmwareMain
+
+#define START_US 3100000 // after the power-up delay in main.c
+#define REPLY_TIMEOUT_US 1000000 // bootloader erases flash on entry
+#define PAGE_RETRIES 3
+
+typedef enum {
+	STEP_START,
+	STEP_ENTER, // 0xE2 sent, application ACK and bootloader ready due
+	STEP_EARLY_DONE, // 0xE4 before page 0, must be refused
+	STEP_BAD_PAGE, // page 0 with bad CRC, must be refused
+	STEP_ZERO_PAGE, // last page all zeros, real data then needs erase
+	STEP_PAGE,
+	STEP_DONE
+} Step;
+
+static jmp_buf simDone;
+static int verbose = 0, failed = 0;
+
+// Image to write, application area only
+static uint8_t image[BOOT_START];
+static int pages; // up to the last non-blank page
+
+// Transaction in progress: bytes to send, then replies to wait for
+static uint8_t tx[SPM_PAGESIZE + 4], rx[2];
+static int txCount, txSent, rxCount, rxWanted;
+static uint64_t lastActivity;
+
+static Step step = STEP_START;
+static int page, retries, pagesSent;
+static uint64_t enterAt, readyAt, pagesAt, doneAt;
+
+static void check(int ok, const char *what) {
+	printf("  %s %s\n", ok ? "ok  " : "FAIL", what);
+
+	if(!ok)
+		failed = 1;
+}
+
+static void fail(const char *what) {
+	check(0, what);
+	longjmp(simDone, 1);
+}
+
+static int loadHex(const char *path) {
+	FILE *f = fopen(path, "r");
+	char line[600];
+	unsigned length, address, type, byte, sum, i;
+	uint32_t base = 0, at;
+	int end = 0;
+
+	if(!f) {
+		perror(path);
+		return 0;
+	}
+
+	memset(image, 0xFF, sizeof(image));
+
+	while(fgets(line, sizeof(line), f)) {
+		if(line[0] != ':')
+			continue;
+
+		if(sscanf(line + 1, "%2x%4x%2x", &length, &address, &type) != 3 ||
+				strlen(line) < 11 + 2 * length) {
+			fprintf(stderr, "%s: bad record\n", path);
+			fclose(f);
+			return 0;
+		}
+
+		sum = length + (address >> 8) + address + type;
+
+		for(i = 0; i <= length; i++) { // data and checksum
+			sscanf(line + 9 + 2 * i, "%2x", &byte);
+			sum += byte;
+
+			if(i == length || type != 0)
+				continue;
+
+			at = base + address + i;
+
+			if(at < BOOT_START) { // bootloader itself is not updated
+				image[at] = byte;
+				if((int)at >= end)
+					end = at + 1;
+			}
+		}
+
+		if(sum & 0xFF) {
+			fprintf(stderr, "%s: bad checksum\n", path);
+			fclose(f);
+			return 0;
+		}
+
+		if(type == 1)
+			break;
+		else if(type == 2 || type == 4) {
+			sscanf(line + 9, "%4x", &byte);
+			base = type == 2 ? byte << 4 : byte << 16;
+		}
+	}
+
+	fclose(f);
+	pages = (end + SPM_PAGESIZE - 1) / SPM_PAGESIZE;
+
+	if(!pages || (image[1] & 0xF0) != 0xC0) {
+		fprintf(stderr, "%s: no rjmp reset vector at address 0\n", path);
+		return 0;
+	}
+
+	return 1;
+}
+
+static uint16_t crc16(uint16_t crc, uint8_t byte) {
+	int i;
+
+	crc ^= byte << 8; // CRC-16/XMODEM
+
+	for(i = 0; i < 8; i++)
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+
+	return crc;
+}
+
+static int blank(int p) {
+	int i;
+
+	for(i = 0; i < SPM_PAGESIZE; i++)
+		if(image[p * SPM_PAGESIZE + i] != 0xFF)
+			return 0;
+
+	return p != 0; // page 0 always goes, it has the reset vector
+}
+
+static void transaction(int replies) {
+	txSent = rxCount = 0;
+	rxWanted = replies;
+	lastActivity = simNow;
+}
+
+// 0xE3 page data crc, with the CRC spoiled or data zeroed if asked to
+static void sendPage(int p, uint16_t spoil, int zero) {
+	uint16_t crc = crc16(0, p);
+	int i;
+
+	tx[0] = BOOT_CMD_Write_Page;
+	tx[1] = p;
+
+	for(i = 0; i < SPM_PAGESIZE; i++) {
+		tx[2 + i] = zero ? 0 : image[p * SPM_PAGESIZE + i];
+		crc = crc16(crc, tx[2 + i]);
+	}
+
+	crc ^= spoil;
+	tx[2 + SPM_PAGESIZE] = crc;
+	tx[3 + SPM_PAGESIZE] = crc >> 8;
+	txCount = SPM_PAGESIZE + 4;
+
+	if(verbose)
+		printf("%10.3f ms page %d%s\n", simNow / 1000.0, p,
+			spoil ? " with bad CRC" : zero ? " with zeros" : "");
+
+	transaction(1);
+}
+
+// 0xE4 pages crc
+static void sendDone() {
+	uint16_t crc = 0;
+	int i;
+
+	for(i = 0; i < pages * SPM_PAGESIZE; i++)
+		crc = crc16(crc, image[i]);
+
+	tx[0] = BOOT_CMD_Done;
+	tx[1] = pages;
+	tx[2] = crc;
+	tx[3] = crc >> 8;
+	txCount = 4;
+
+	if(verbose)
+		printf("%10.3f ms done, %d pages\n", simNow / 1000.0, pages);
+
+	transaction(1);
+}
+
+static void nextPage() {
+	while(page < pages && blank(page))
+		page++;
+
+	retries = 0;
+
+	if(page < pages) {
+		sendPage(page, 0, 0);
+	} else {
+		step = STEP_DONE;
+		sendDone();
+	}
+}
+
+// All replies of a transaction are in
+static void replied() {
+	switch(step) {
+		case STEP_ENTER:
+			readyAt = simNow;
+			check(rx[0] == 0xFA && rx[1] == BOOT_READY,
+				"application ACKs 0xE2, bootloader sends ready");
+			check(simEeprom[BOOT_EEPROM_VALID] != BOOT_VALID,
+				"application marked invalid");
+			check(simFlash[0] == (BOOT_RESET_VECTOR & 0xFF) &&
+				simFlash[1] == BOOT_RESET_VECTOR >> 8,
+				"reset vector points to bootloader");
+			step = STEP_EARLY_DONE;
+			sendDone();
+			break;
+
+		case STEP_EARLY_DONE:
+			check(rx[0] == BOOT_ERROR &&
+				simEeprom[BOOT_EEPROM_VALID] != BOOT_VALID,
+				"0xE4 before page 0 is written is refused");
+			step = STEP_BAD_PAGE;
+			sendPage(0, 0x0100, 0);
+			break;
+
+		case STEP_BAD_PAGE:
+			check(rx[0] == BOOT_ERROR, "page with bad CRC is refused");
+			step = STEP_ZERO_PAGE;
+			sendPage(pages - 1, 0, 1);
+			break;
+
+		case STEP_ZERO_PAGE:
+			check(rx[0] == BOOT_ACK, "page of zeros accepted");
+			pagesAt = simNow;
+			step = STEP_PAGE;
+			page = 0;
+			nextPage();
+			break;
+
+		case STEP_PAGE:
+			if(rx[0] == BOOT_ACK) {
+				pagesSent++;
+				page++;
+				nextPage();
+			} else if(++retries > PAGE_RETRIES) {
+				fail("page refused repeatedly");
+			} else
+				sendPage(page, 0, 0);
+			break;
+
+		case STEP_DONE:
+			doneAt = simNow;
+			check(rx[0] == BOOT_ACK, "0xE4 with image CRC accepted");
+			if(rx[0] != BOOT_ACK)
+				longjmp(simDone, 1);
+			break; // watchdog reset follows
+
+		default:
+			break;
+	}
+}
+
+static void hostLogic() {
+	if(step == STEP_START) {
+		if(simNow < START_US)
+			return;
+
+		enterAt = simNow;
+		step = STEP_ENTER;
+		tx[0] = PS2_CMD_Vendor_Update;
+		txCount = 1;
+		transaction(2);
+	}
+
+	if(txSent < txCount) {
+		simHostSend(tx[txSent], 0);
+		return;
+	}
+
+	if(simNow - lastActivity > REPLY_TIMEOUT_US)
+		fail("no reply from device");
+}
+
+static void hostDone(uint8_t acked) {
+	if(acked)
+		txSent++; // otherwise same byte again
+	lastActivity = simNow;
+}
+
+static void hostReceived(uint8_t byte) {
+	lastActivity = simNow;
+
+	if(byte == BOOT_RESEND && txSent) { // bad parity, repeat that byte
+		txSent--;
+		return;
+	}
+
+	if(rxCount < rxWanted)
+		rx[rxCount++] = byte;
+
+	if(rxCount == rxWanted && txSent == txCount)
+		replied();
+}
+
+static void reset() {
+	uint16_t vector = simEeprom[BOOT_EEPROM_VECTOR] |
+		simEeprom[BOOT_EEPROM_VECTOR + 1] << 8;
+	uint16_t rjmp = image[0] | image[1] << 8;
+
+	if(step != STEP_DONE || !doneAt)
+		fail("unexpected watchdog reset");
+
+	check(simEeprom[BOOT_EEPROM_VALID] == BOOT_VALID,
+		"application marked valid");
+	check(vector == ((rjmp + 1) & 0x0FFF),
+		"application entry saved from image reset vector");
+	check(simFlash[0] == (BOOT_RESET_VECTOR & 0xFF) &&
+		simFlash[1] == BOOT_RESET_VECTOR >> 8 &&
+		!memcmp(simFlash + 2, image + 2, BOOT_START - 2),
+		"flash holds image with reset vector to bootloader, page of "
+		"zeros erased");
+
+	longjmp(simDone, 1);
+}
+
+int main(int argc, char *argv[]) {
+	int opt, i;
+	double seconds;
+
+	while((opt = getopt(argc, argv, "v")) != -1) {
+		if(opt == 'v')
+			verbose = 1;
+		else {
+			fprintf(stderr, "usage: %s [-v] image.hex\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if(optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-v] image.hex\n", argv[0]);
+		return 2;
+	}
+
+	if(!loadHex(argv[optind]))
+		return 1;
+
+	printf("%s: %d of %d application pages\n", argv[optind], pages,
+		BOOT_PAGES);
+
+	simHostLogic = hostLogic;
+	simHostReceived = hostReceived;
+	simHostDone = hostDone;
+	simHostInit();
+	simReset = reset;
+
+	if(!setjmp(simDone))
+		firmwareMain(); // returns through longjmp when done
+
+	if(doneAt) {
+		seconds = (doneAt - pagesAt) / 1e6;
+		printf("  entering bootloader took %.2f s, %d pages and 0xE4 "
+			"%.2f s (%.1f ms per page), all %d pages would take %.2f s\n",
+			(readyAt - enterAt) / 1e6, pagesSent, seconds,
+			seconds * 1000 / pagesSent, BOOT_PAGES,
+			(readyAt - enterAt) / 1e6 + seconds / pagesSent * BOOT_PAGES);
+	}
+
+	printf("  violations:");
+
+	for(i = 0; i < SIM_VIOLATIONS; i++)
+		printf("%s %s %u", i ? "," : "", simViolationNames[i],
+			simViolations[i]);
+
+	printf("\n");
+
+	return failed || !doneAt;
+}
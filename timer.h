@@ -1,6 +1,8 @@
 /**
  * PS/2 keyboard implementation and knock sensor.
- * Timer routines.
+ * Timer routines. Prescaler and compare values are selected at compile
+ * time from F_CPU and the requested frequencies, so the runtime part is
+ * just a few register writes.
  *
  * Copyright (C) Joonas Pihlajamaa 2013.
  * Licensed under GNU GPL v3, see LICENSE for details.
@@ -16,13 +18,187 @@
 #error "Only ATtiny2313 and ATtiny45/85 are supported!"
 #endif
 
+#ifndef F_CPU
+#error "F_CPU must be defined!"
+#endif
+
 #include <avr/io.h>
 
 #define INT_VECT_0 TIMER0_COMPA_vect
 #define INT_VECT_1 TIMER1_COMPA_vect
 
-uint8_t startTimer_0(uint32_t hz);
+// Timer 0 drives the PS/2 clock generation and logic
+#ifndef TIMER0_HZ
+#define TIMER0_HZ 50000L
+#endif
+
+// Timer 1 is free for other uses, the timebase runs from timer 0
+#ifndef TIMER1_HZ
+#define TIMER1_HZ 1000L
+#endif
+
+// Largest allowed difference between requested and achieved tick
+// frequency, in parts per million (default 0.5 %)
+#ifndef TIMER_TOLERANCE_PPM
+#define TIMER_TOLERANCE_PPM 5000L
+#endif
+
+// Rounded number of prescaled timer counts per tick
+#define TIMER_COUNTS(hz, prescale) \
+	((F_CPU + (prescale) * (hz) / 2) / ((prescale) * (hz)))
+
+// Error of the achieved tick period in ppm, written without negative
+// intermediates so it also works with an unsigned (UL) F_CPU
+#define TIMER_CLOCKS(hz, prescale) \
+	(TIMER_COUNTS(hz, prescale) * (prescale) * (hz))
+#define TIMER_ERROR_PPM(hz, prescale) \
+	((TIMER_CLOCKS(hz, prescale) > F_CPU ? \
+		TIMER_CLOCKS(hz, prescale) - F_CPU : \
+		F_CPU - TIMER_CLOCKS(hz, prescale)) * 1000000L / F_CPU)
+
+// Timer 0 is 8-bit on all supported devices, prescales 1..1024
+#if TIMER_COUNTS(TIMER0_HZ, 1) <= 256
+#define TIMER0_PRESCALE 1
+#define TIMER0_CS (_BV(CS00))
+#elif TIMER_COUNTS(TIMER0_HZ, 8) <= 256
+#define TIMER0_PRESCALE 8
+#define TIMER0_CS (_BV(CS01))
+#elif TIMER_COUNTS(TIMER0_HZ, 64) <= 256
+#define TIMER0_PRESCALE 64
+#define TIMER0_CS (_BV(CS01) + _BV(CS00))
+#elif TIMER_COUNTS(TIMER0_HZ, 256) <= 256
+#define TIMER0_PRESCALE 256
+#define TIMER0_CS (_BV(CS02))
+#elif TIMER_COUNTS(TIMER0_HZ, 1024) <= 256
+#define TIMER0_PRESCALE 1024
+#define TIMER0_CS (_BV(CS02) + _BV(CS00))
+#else
+#error "TIMER0_HZ is too low for this F_CPU"
+#endif
+
+#if TIMER_COUNTS(TIMER0_HZ, TIMER0_PRESCALE) < 1
+#error "TIMER0_HZ is too high for this F_CPU"
+#endif
+
+#if TIMER_ERROR_PPM(TIMER0_HZ, TIMER0_PRESCALE) > TIMER_TOLERANCE_PPM
+#error "TIMER0_HZ cannot be reached within TIMER_TOLERANCE_PPM"
+#endif
+
+#define TIMER0_OCR (TIMER_COUNTS(TIMER0_HZ, TIMER0_PRESCALE) - 1)
+
+// Timer 0 also drives the millisecond timebase
+#if TIMER0_HZ % 1000 || TIMER0_HZ / 1000 > 255
+#error "TIMER0_HZ must be a multiple of 1 kHz, at most 255 kHz"
+#endif
+
+#define TIMER0_TICKS_PER_MS (TIMER0_HZ / 1000)
+#define TIMER0_TICK_US (1000000L / TIMER0_HZ)
+
+#if defined(__AVR_ATtiny2313__) // uses 16-bit timer/counter 1
+
+#if TIMER_COUNTS(TIMER1_HZ, 1) <= 65536L
+#define TIMER1_PRESCALE 1
+#define TIMER1_CS (_BV(CS10))
+#elif TIMER_COUNTS(TIMER1_HZ, 8) <= 65536L
+#define TIMER1_PRESCALE 8
+#define TIMER1_CS (_BV(CS11))
+#elif TIMER_COUNTS(TIMER1_HZ, 64) <= 65536L
+#define TIMER1_PRESCALE 64
+#define TIMER1_CS (_BV(CS11) + _BV(CS10))
+#elif TIMER_COUNTS(TIMER1_HZ, 256) <= 65536L
+#define TIMER1_PRESCALE 256
+#define TIMER1_CS (_BV(CS12))
+#elif TIMER_COUNTS(TIMER1_HZ, 1024) <= 65536L
+#define TIMER1_PRESCALE 1024
+#define TIMER1_CS (_BV(CS12) + _BV(CS10))
+#else
+#error "TIMER1_HZ is too low for this F_CPU"
+#endif
 
-uint8_t startTimer_1(uint32_t hz);
+#elif defined(__AVR_ATtiny85__) || defined(__AVR_ATtiny45__)
+
+// By default we should be in synchronous mode with ATtiny45 so
+// prescales are relative to system clock, not peripheral clock.
+// CS1[3:0] = n selects prescale 2^(n-1).
+#if TIMER_COUNTS(TIMER1_HZ, 1) <= 256
+#define TIMER1_PRESCALE 1
+#define TIMER1_CS (1 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 2) <= 256
+#define TIMER1_PRESCALE 2
+#define TIMER1_CS (2 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 4) <= 256
+#define TIMER1_PRESCALE 4
+#define TIMER1_CS (3 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 8) <= 256
+#define TIMER1_PRESCALE 8
+#define TIMER1_CS (4 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 16) <= 256
+#define TIMER1_PRESCALE 16
+#define TIMER1_CS (5 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 32) <= 256
+#define TIMER1_PRESCALE 32
+#define TIMER1_CS (6 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 64) <= 256
+#define TIMER1_PRESCALE 64
+#define TIMER1_CS (7 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 128) <= 256
+#define TIMER1_PRESCALE 128
+#define TIMER1_CS (8 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 256) <= 256
+#define TIMER1_PRESCALE 256
+#define TIMER1_CS (9 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 512) <= 256
+#define TIMER1_PRESCALE 512
+#define TIMER1_CS (10 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 1024) <= 256
+#define TIMER1_PRESCALE 1024
+#define TIMER1_CS (11 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 2048) <= 256
+#define TIMER1_PRESCALE 2048
+#define TIMER1_CS (12 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 4096) <= 256
+#define TIMER1_PRESCALE 4096
+#define TIMER1_CS (13 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 8192) <= 256
+#define TIMER1_PRESCALE 8192
+#define TIMER1_CS (14 << CS10)
+#elif TIMER_COUNTS(TIMER1_HZ, 16384) <= 256
+#define TIMER1_PRESCALE 16384
+#define TIMER1_CS (15 << CS10)
+#else
+#error "TIMER1_HZ is too low for this F_CPU"
+#endif
+
+#endif
+
+#if TIMER_COUNTS(TIMER1_HZ, TIMER1_PRESCALE) < 1
+#error "TIMER1_HZ is too high for this F_CPU"
+#endif
+
+#if TIMER_ERROR_PPM(TIMER1_HZ, TIMER1_PRESCALE) > TIMER_TOLERANCE_PPM
+#error "TIMER1_HZ cannot be reached within TIMER_TOLERANCE_PPM"
+#endif
+
+#define TIMER1_OCR (TIMER_COUNTS(TIMER1_HZ, TIMER1_PRESCALE) - 1)
+
+// Start timer 0 at TIMER0_HZ with compare match interrupt
+static inline void startTimer_0() {
+	TIMSK |= _BV(OCIE0A); // timer 0 (8-bit) output compare interrupt
+	TCCR0A = _BV(WGM01); // WGM02:0 = 2, Clear Timer on Compare
+	OCR0A = TIMER0_OCR;
+	TCCR0B = TIMER0_CS;
+}
+
+// Start timer 1 at TIMER1_HZ with compare match interrupt
+static inline void startTimer_1() {
+	TIMSK |= _BV(OCIE1A); // timer 1 output compare interrupt
+	OCR1A = TIMER1_OCR;
+#if defined(__AVR_ATtiny2313__)
+	TCCR1B = _BV(WGM12) + TIMER1_CS; // CTC on OCR1A
+#elif defined(__AVR_ATtiny85__) || defined(__AVR_ATtiny45__)
+	OCR1C = TIMER1_OCR; // CTC1 clears on OCR1C, not OCR1A
+	TCCR1 = _BV(CTC1) + TIMER1_CS;
+#endif
+}
 
 #endif